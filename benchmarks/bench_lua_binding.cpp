@@ -0,0 +1,172 @@
+// Measures the lua <-> native call paths of the binding.
+#include "lua_binding.h"
+
+#include <nonius/nonius.h++>
+#include <nonius/html_group_reporter.h>
+
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Registered like Sprite, but without printing, so that only the binding is measured.
+class BenchObject
+{
+public:
+    int x = 0;
+    int y = 0;
+
+    void Method0()
+    {
+    }
+
+    int Method2(int a, int b)
+    {
+        return a + b;
+    }
+
+    int Method6(int a, int b, int c, int d, int e, int f)
+    {
+        return a + b + c + d + e + f;
+    }
+
+    int ThunkMethod2(int a, int b)
+    {
+        return a + b;
+    }
+};
+
+void GlobalMethod0()
+{
+}
+
+int GlobalMethod2(int a, int b)
+{
+    return a + b;
+}
+
+void RegisterBenchmarkTypes()
+{
+    rttr::registration::method("GlobalMethod0", &GlobalMethod0);
+    rttr::registration::method("GlobalMethod2", &GlobalMethod2);
+    rttr::registration::class_<BenchObject>("BenchObject")(LuaInlineStorageMetadata<BenchObject>())
+            .constructor()
+            .method("Method0", &BenchObject::Method0)
+            .method("Method2", &BenchObject::Method2)
+            .method("Method6", &BenchObject::Method6)
+            .method("ThunkMethod2", &BenchObject::ThunkMethod2)(LuaThunkMetadata<&BenchObject::ThunkMethod2>())
+            .property("x", &BenchObject::x)(LuaFieldMetadata<&BenchObject::x>())
+            .property("y", &BenchObject::y);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
+// Every benchmark calls a lua function named Bench, defined by the script, once per measurement.
+nonius::benchmark BenchLuaFunction(const std::string& name, const char* script)
+{
+    return nonius::benchmark(name, [script](nonius::chronometer meter)
+    {
+        lua_State* L = CreateLuaState();
+        if (luaL_dostring(L, script) != LUA_OK)
+        {
+            throw std::runtime_error(lua_tostring(L, -1));
+        }
+        lua_getglobal(L, "Bench");
+        int benchReference = luaL_ref(L, LUA_REGISTRYINDEX);
+        // A failing Bench would otherwise be measured as if it ran
+        lua_rawgeti(L, LUA_REGISTRYINDEX, benchReference);
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+        {
+            throw std::runtime_error(lua_tostring(L, -1));
+        }
+        meter.measure([L, benchReference]()
+        {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, benchReference);
+            int status = lua_pcall(L, 0, 0, 0);
+            if (status != LUA_OK)
+            {
+                lua_pop(L, 1);
+            }
+            return status;
+        });
+        DestroyLuaState(L);
+    });
+}
+
+nonius::benchmark BenchEmptyLuaFunction()
+{
+    return BenchLuaFunction("empty lua function", "function Bench() end");
+}
+
+template<typename... T>
+nonius::benchmark BenchCallLuaMethod(const std::string& name, const char* script, T... arguments)
+{
+    return nonius::benchmark(name, [script, arguments...](nonius::chronometer meter)
+    {
+        lua_State* L = CreateLuaState();
+        if (luaL_dostring(L, script) != LUA_OK)
+        {
+            throw std::runtime_error(lua_tostring(L, -1));
+        }
+        std::tuple<T...> callArguments(arguments...);
+        meter.measure([L, &callArguments]()
+        {
+            std::apply([L](T& ... callArgument) { CallLuaMethod(L, "Bench", callArgument...); }, callArguments);
+        });
+        DestroyLuaState(L);
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
+void RunBenchmarkGroup(nonius::html_group_reporter& reporter, const char* groupName, std::vector<nonius::benchmark> benchmarks)
+{
+    nonius::configuration configuration;
+    configuration.title = "lua binding";
+    reporter.set_current_group_name(groupName);
+    nonius::go(configuration, benchmarks.begin(), benchmarks.end(), reporter);
+}
+
+int main(int /* argc */, char** /* argv */)
+{
+    RegisterBenchmarkTypes();
+
+    nonius::html_group_reporter reporter;
+    reporter.set_output_file("benchmark_lua_binding.html");
+
+    RunBenchmarkGroup(reporter, "global method", {
+            BenchEmptyLuaFunction(),
+            BenchLuaFunction("0 arguments", "function Bench() Global.GlobalMethod0() end"),
+            BenchLuaFunction("2 arguments", "function Bench() Global.GlobalMethod2(1, 2) end"),
+    });
+
+    RunBenchmarkGroup(reporter, "method", {
+            BenchEmptyLuaFunction(),
+            BenchLuaFunction("0 arguments", "local o = BenchObject.new() function Bench() o:Method0() end"),
+            BenchLuaFunction("2 arguments", "local o = BenchObject.new() function Bench() o:Method2(1, 2) end"),
+            BenchLuaFunction("6 arguments", "local o = BenchObject.new() function Bench() o:Method6(1, 2, 3, 4, 5, 6) end"),
+            BenchLuaFunction("2 arguments (thunk)", "local o = BenchObject.new() function Bench() o:ThunkMethod2(1, 2) end"),
+    });
+
+    RunBenchmarkGroup(reporter, "property", {
+            BenchEmptyLuaFunction(),
+            BenchLuaFunction("get", "local o = BenchObject.new() function Bench() local y = o.y end"),
+            BenchLuaFunction("set", "local o = BenchObject.new() function Bench() o.y = 1 end"),
+            BenchLuaFunction("get (field)", "local o = BenchObject.new() function Bench() local x = o.x end"),
+            BenchLuaFunction("set (field)", "local o = BenchObject.new() function Bench() o.x = 1 end"),
+    });
+
+    // Collecting the objects is amortized over the creations by the incremental garbage collector
+    RunBenchmarkGroup(reporter, "object lifetime", {
+            BenchEmptyLuaFunction(),
+            BenchLuaFunction("new and __gc", "function Bench() BenchObject.new() end"),
+    });
+
+    BenchObject object;
+    RunBenchmarkGroup(reporter, "CallLuaMethod", {
+            BenchCallLuaMethod("0 arguments", "function Bench() end"),
+            BenchCallLuaMethod("2 arguments", "function Bench(a, b) end", 1, 2),
+            BenchCallLuaMethod("object argument", "function Bench(o) end", object),
+    });
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "component_pool.h"
+
+#include <cstring>
+
+ComponentPool::ComponentPool(const rttr::type& type)
+        : type(type)
+{
+    for (const auto& property : type.get_properties())
+    {
+        const rttr::type& propertyType = property.get_type();
+        if (propertyType.is_arithmetic())
+        {
+            columns.push_back({property, propertyType, propertyType.get_sizeof(), {}});
+        }
+    }
+}
+
+const rttr::type& ComponentPool::GetType() const
+{
+    return type;
+}
+
+uint32_t ComponentPool::GetSize() const
+{
+    return (uint32_t) denseToSlotIndices.size();
+}
+
+ComponentPool::Handle ComponentPool::Create()
+{
+    uint32_t slotIndex;
+    if (freeSlotIndices.empty())
+    {
+        slotIndex = (uint32_t) slots.size();
+        constexpr uint32_t firstGeneration = 1;
+        slots.push_back({firstGeneration, 0});
+    }
+    else
+    {
+        slotIndex = freeSlotIndices.back();
+        freeSlotIndices.pop_back();
+    }
+    Slot& slot = slots[slotIndex];
+    slot.denseIndex = GetSize();
+    denseToSlotIndices.push_back(slotIndex);
+    for (Column& column : columns)
+    {
+        column.data.resize(column.data.size() + column.elementSize);
+    }
+    return ((Handle) slot.generation << 32) | slotIndex;
+}
+
+bool ComponentPool::Destroy(Handle handle)
+{
+    if (!IsValid(handle))
+    {
+        return false;
+    }
+    Slot& slot = slots[GetSlotIndex(handle)];
+    uint32_t denseIndex = slot.denseIndex;
+    uint32_t lastDenseIndex = GetSize() - 1;
+    if (denseIndex != lastDenseIndex)
+    {
+        for (Column& column : columns)
+        {
+            memcpy(GetElement(column, denseIndex), GetElement(column, lastDenseIndex), column.elementSize);
+        }
+        uint32_t movedSlotIndex = denseToSlotIndices[lastDenseIndex];
+        denseToSlotIndices[denseIndex] = movedSlotIndex;
+        slots[movedSlotIndex].denseIndex = denseIndex;
+    }
+    denseToSlotIndices.pop_back();
+    for (Column& column : columns)
+    {
+        column.data.resize(column.data.size() - column.elementSize);
+    }
+
+    // Generation 0 is never handed out, so a zero handle is never valid.
+    slot.generation++;
+    if (slot.generation == 0)
+    {
+        slot.generation++;
+    }
+    freeSlotIndices.push_back(GetSlotIndex(handle));
+    return true;
+}
+
+bool ComponentPool::IsValid(Handle handle) const
+{
+    uint32_t slotIndex = GetSlotIndex(handle);
+    return slotIndex < slots.size() && slots[slotIndex].generation == GetGeneration(handle);
+}
+
+uint32_t ComponentPool::GetDenseIndex(Handle handle) const
+{
+    return slots[GetSlotIndex(handle)].denseIndex;
+}
+
+std::vector<ComponentPool::Column>& ComponentPool::GetColumns()
+{
+    return columns;
+}
+
+ComponentPool::Column* ComponentPool::FindColumn(std::string_view propertyName)
+{
+    for (Column& column : columns)
+    {
+        const rttr::string_view& name = column.property.get_name();
+        if (std::string_view(name.data(), name.size()) == propertyName)
+        {
+            return &column;
+        }
+    }
+    return nullptr;
+}
+
+void* ComponentPool::GetElement(Column& column, uint32_t denseIndex)
+{
+    return column.data.data() + (size_t) denseIndex * column.elementSize;
+}
+
+uint32_t ComponentPool::GetSlotIndex(Handle handle)
+{
+    return (uint32_t) (handle & 0xffffffff);
+}
+
+uint32_t ComponentPool::GetGeneration(Handle handle)
+{
+    return (uint32_t) (handle >> 32);
+}
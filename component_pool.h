@@ -0,0 +1,78 @@
+#pragma once
+
+#include <rttr/type>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Stores the instances of a registered class as one contiguous array per arithmetic property (structure of arrays)
+// instead of as separate objects. Live instances are kept densely packed at [0, GetSize()) so native systems can
+// iterate a column without holes, and are referred to from the outside through generational handles that can be
+// validated in constant time.
+class ComponentPool
+{
+public:
+    using Handle = uint64_t;
+
+    struct Column
+    {
+        rttr::property property;
+        rttr::type type;
+        size_t elementSize;
+        std::vector<unsigned char> data;
+    };
+
+private:
+    struct Slot
+    {
+        uint32_t generation;
+        uint32_t denseIndex;
+    };
+
+    rttr::type type;
+    std::vector<Column> columns;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlotIndices;
+    std::vector<uint32_t> denseToSlotIndices;
+
+public:
+    explicit ComponentPool(const rttr::type& type);
+
+    const rttr::type& GetType() const;
+
+    uint32_t GetSize() const;
+
+    // Creates a zero-initialized instance.
+    Handle Create();
+
+    // Removes the instance by moving the last instance into its place. Returns false for invalid handles.
+    bool Destroy(Handle handle);
+
+    bool IsValid(Handle handle) const;
+
+    // Position of the instance in every column. Only meaningful for valid handles, and only until the next Destroy.
+    uint32_t GetDenseIndex(Handle handle) const;
+
+    std::vector<Column>& GetColumns();
+
+    Column* FindColumn(std::string_view propertyName);
+
+    void* GetElement(Column& column, uint32_t denseIndex);
+
+    // Returns nullptr when there is no column for the property or when it does not hold values of type T.
+    template<typename T>
+    T* GetColumnData(std::string_view propertyName)
+    {
+        Column* column = FindColumn(propertyName);
+        if (column == nullptr || column->type != rttr::type::get<T>())
+        {
+            return nullptr;
+        }
+        return (T*) column->data.data();
+    }
+
+private:
+    static uint32_t GetSlotIndex(Handle handle);
+
+    static uint32_t GetGeneration(Handle handle);
+};
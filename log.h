@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+
+// The log level is fixed at compile time. Statements below it expand to nothing, so their arguments
+// (including any type/method name lookups) are never evaluated.
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL LOG_LEVEL_OFF
+#else
+#define LOG_LEVEL LOG_LEVEL_TRACE
+#endif
+#endif
+
+// Expands an rttr::string_view (or std::string_view) into the arguments of a "%.*s" format specifier,
+// which avoids copying names into a std::string just to log them.
+#define LOG_STRING_VIEW(view) static_cast<int>((view).size()), (view).data()
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((format(printf, 2, 3)))
+#endif
+inline void LogWrite(const char* level, const char* format, ...)
+{
+    printf("[%s] ", level);
+    va_list arguments;
+    va_start(arguments, format);
+    vprintf(format, arguments);
+    va_end(arguments);
+    printf("\n");
+}
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LogWrite("trace", __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void) 0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LogWrite("debug", __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void) 0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LogWrite("info", __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void) 0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LogWrite("warn", __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void) 0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LogWrite("error", __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void) 0)
+#endif
@@ -0,0 +1,208 @@
+#include "lua_allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    // Keeps the blocks after the chunk header aligned for any lua object
+    constexpr size_t ChunkHeaderSize = LuaPoolAllocator::BlockGranularity;
+}
+
+LuaPoolAllocator::LuaPoolAllocator(size_t maxReservedBytes)
+        : maxReservedBytes(maxReservedBytes)
+{
+    for (size_t i = 0; i < SizeClassCount; i++)
+    {
+        sizeClasses[i].stats.blockSize = (i + 1) * BlockGranularity;
+    }
+}
+
+LuaPoolAllocator::~LuaPoolAllocator()
+{
+    while (chunks != nullptr)
+    {
+        Chunk* next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+}
+
+void* LuaPoolAllocator::Allocate(void* userdata, void* pointer, size_t oldSize, size_t newSize)
+{
+    return static_cast<LuaPoolAllocator*>(userdata)->Reallocate(pointer, oldSize, newSize);
+}
+
+size_t LuaPoolAllocator::GetReservedBytes() const
+{
+    return reservedBytes;
+}
+
+size_t LuaPoolAllocator::GetLargeAllocationCount() const
+{
+    return largeAllocationCount;
+}
+
+size_t LuaPoolAllocator::GetLiveLargeAllocationCount() const
+{
+    return liveLargeAllocationCount;
+}
+
+LuaPoolAllocator::SizeClassStats LuaPoolAllocator::GetSizeClassStats(size_t sizeClassIndex) const
+{
+    return sizeClasses[sizeClassIndex].stats;
+}
+
+size_t LuaPoolAllocator::GetSizeClassIndex(size_t size)
+{
+    return size <= MaxBlockSize ? (size - 1) / BlockGranularity : SizeClassCount;
+}
+
+void* LuaPoolAllocator::Reallocate(void* pointer, size_t oldSize, size_t newSize)
+{
+    // For new blocks lua passes the type of the object being created as the old size
+    if (pointer == nullptr)
+    {
+        oldSize = 0;
+    }
+    if (newSize == 0)
+    {
+        if (pointer != nullptr)
+        {
+            ReleaseBlock(pointer, oldSize);
+        }
+        return nullptr;
+    }
+    size_t newSizeClassIndex = GetSizeClassIndex(newSize);
+    if (pointer != nullptr)
+    {
+        size_t oldSizeClassIndex = GetSizeClassIndex(oldSize);
+        if (oldSizeClassIndex == newSizeClassIndex && newSizeClassIndex < SizeClassCount)
+        {
+            return pointer;
+        }
+        if (oldSizeClassIndex == SizeClassCount && newSizeClassIndex == SizeClassCount)
+        {
+            bool isGrowing = newSize > oldSize;
+            if (isGrowing && !CanReserve(newSize - oldSize, true))
+            {
+                return nullptr;
+            }
+            void* newPointer = realloc(pointer, newSize);
+            if (newPointer == nullptr && !isGrowing)
+            {
+                // The old block is big enough, it is just accounted for with its new size from now on
+                newPointer = pointer;
+            }
+            if (newPointer != nullptr)
+            {
+                reservedBytes = reservedBytes - oldSize + newSize;
+            }
+            return newPointer;
+        }
+    }
+    bool enforceLimit = newSize > oldSize;
+    void* newPointer = AllocateBlock(newSize, enforceLimit);
+    if (newPointer == nullptr && pointer != nullptr && !enforceLimit && GetSizeClassIndex(oldSize) < SizeClassCount)
+    {
+        // Hands the old block over to the smaller size class instead, it is big enough and lives in a chunk as well
+        MoveBlockToSizeClass(GetSizeClassIndex(oldSize), newSizeClassIndex);
+        return pointer;
+    }
+    if (newPointer != nullptr && pointer != nullptr)
+    {
+        memcpy(newPointer, pointer, std::min(oldSize, newSize));
+        ReleaseBlock(pointer, oldSize);
+    }
+    return newPointer;
+}
+
+void* LuaPoolAllocator::AllocateBlock(size_t size, bool enforceLimit)
+{
+    size_t sizeClassIndex = GetSizeClassIndex(size);
+    if (sizeClassIndex == SizeClassCount)
+    {
+        if (!CanReserve(size, enforceLimit))
+        {
+            return nullptr;
+        }
+        void* pointer = malloc(size);
+        if (pointer != nullptr)
+        {
+            reservedBytes += size;
+            largeAllocationCount++;
+            liveLargeAllocationCount++;
+        }
+        return pointer;
+    }
+
+    SizeClass& sizeClass = sizeClasses[sizeClassIndex];
+    void* block;
+    if (sizeClass.freeBlocks != nullptr)
+    {
+        block = sizeClass.freeBlocks;
+        sizeClass.freeBlocks = sizeClass.freeBlocks->next;
+    }
+    else
+    {
+        size_t blockSize = sizeClass.stats.blockSize;
+        if (sizeClass.nextBlock == sizeClass.blocksEnd)
+        {
+            if (!CanReserve(ChunkSize, enforceLimit))
+            {
+                return nullptr;
+            }
+            auto* chunk = static_cast<Chunk*>(malloc(ChunkSize));
+            if (chunk == nullptr)
+            {
+                return nullptr;
+            }
+            chunk->next = chunks;
+            chunks = chunk;
+            reservedBytes += ChunkSize;
+            size_t blockCount = (ChunkSize - ChunkHeaderSize) / blockSize;
+            sizeClass.nextBlock = reinterpret_cast<unsigned char*>(chunk) + ChunkHeaderSize;
+            sizeClass.blocksEnd = sizeClass.nextBlock + blockCount * blockSize;
+            sizeClass.stats.reservedBlockCount += blockCount;
+        }
+        block = sizeClass.nextBlock;
+        sizeClass.nextBlock += blockSize;
+    }
+    SizeClassStats& stats = sizeClass.stats;
+    stats.allocationCount++;
+    stats.liveBlockCount++;
+    stats.peakLiveBlockCount = std::max(stats.peakLiveBlockCount, stats.liveBlockCount);
+    return block;
+}
+
+void LuaPoolAllocator::MoveBlockToSizeClass(size_t oldSizeClassIndex, size_t newSizeClassIndex)
+{
+    sizeClasses[oldSizeClassIndex].stats.liveBlockCount--;
+    SizeClassStats& stats = sizeClasses[newSizeClassIndex].stats;
+    stats.allocationCount++;
+    stats.liveBlockCount++;
+    stats.peakLiveBlockCount = std::max(stats.peakLiveBlockCount, stats.liveBlockCount);
+}
+
+void LuaPoolAllocator::ReleaseBlock(void* pointer, size_t size)
+{
+    size_t sizeClassIndex = GetSizeClassIndex(size);
+    if (sizeClassIndex == SizeClassCount)
+    {
+        free(pointer);
+        reservedBytes -= size;
+        liveLargeAllocationCount--;
+        return;
+    }
+    SizeClass& sizeClass = sizeClasses[sizeClassIndex];
+    auto* block = static_cast<FreeBlock*>(pointer);
+    block->next = sizeClass.freeBlocks;
+    sizeClass.freeBlocks = block;
+    sizeClass.stats.liveBlockCount--;
+}
+
+bool LuaPoolAllocator::CanReserve(size_t size, bool enforceLimit) const
+{
+    return !enforceLimit || maxReservedBytes == Unlimited || reservedBytes + size <= maxReservedBytes;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// Size-class pool allocator for lua_newstate. Lua allocates lots of small objects of a handful of sizes (strings,
+// closures, tables, userdata), so requests up to MaxBlockSize are rounded up to a size class and served from chunks
+// that are carved into equally sized blocks, with freed blocks kept on a per-class free list for reuse. Larger
+// requests go straight to realloc/free.
+//
+// Lua passes the old size of a block back into the allocator, so the blocks carry no header. An allocator is an
+// arena for exactly one lua state and is not thread safe; its chunks are only returned to the system when it is
+// destroyed, which has to happen after lua_close.
+class LuaPoolAllocator
+{
+public:
+    static constexpr size_t Unlimited = 0;
+    static constexpr size_t BlockGranularity = 16;
+    static constexpr size_t MaxBlockSize = 256;
+    static constexpr size_t SizeClassCount = MaxBlockSize / BlockGranularity;
+    static constexpr size_t ChunkSize = 16 * 1024;
+
+    struct SizeClassStats
+    {
+        size_t blockSize = 0;
+        size_t allocationCount = 0;
+        size_t liveBlockCount = 0;
+        size_t peakLiveBlockCount = 0;
+        size_t reservedBlockCount = 0;
+    };
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock* freeBlocks = nullptr;
+        unsigned char* nextBlock = nullptr;
+        unsigned char* blocksEnd = nullptr;
+        SizeClassStats stats;
+    };
+
+    struct Chunk
+    {
+        Chunk* next;
+    };
+
+    std::array<SizeClass, SizeClassCount> sizeClasses;
+    Chunk* chunks = nullptr;
+    size_t maxReservedBytes;
+    size_t reservedBytes = 0;
+    size_t largeAllocationCount = 0;
+    size_t liveLargeAllocationCount = 0;
+
+public:
+    // The allocator fails requests (so lua raises a memory error) once the chunks and large allocations it holds
+    // would exceed maxReservedBytes. Shrinking a block is never limited by maxReservedBytes, and a shrink that stays
+    // within the size classes or stays large is done in place when no smaller block can be had. Only a large block
+    // shrinking into a size class with no free blocks needs a new chunk, which fails when the system is out of memory.
+    explicit LuaPoolAllocator(size_t maxReservedBytes = Unlimited);
+
+    ~LuaPoolAllocator();
+
+    LuaPoolAllocator(const LuaPoolAllocator&) = delete;
+
+    LuaPoolAllocator& operator=(const LuaPoolAllocator&) = delete;
+
+    // lua_Alloc to pass to lua_newstate together with the allocator as userdata.
+    static void* Allocate(void* userdata, void* pointer, size_t oldSize, size_t newSize);
+
+    // Bytes held from the system: all chunks, used or not, plus the live large allocations.
+    size_t GetReservedBytes() const;
+
+    size_t GetLargeAllocationCount() const;
+
+    size_t GetLiveLargeAllocationCount() const;
+
+    SizeClassStats GetSizeClassStats(size_t sizeClassIndex) const;
+
+private:
+    static size_t GetSizeClassIndex(size_t size);
+
+    void* Reallocate(void* pointer, size_t oldSize, size_t newSize);
+
+    void* AllocateBlock(size_t size, bool enforceLimit);
+
+    void MoveBlockToSizeClass(size_t oldSizeClassIndex, size_t newSizeClassIndex);
+
+    void ReleaseBlock(void* pointer, size_t size);
+
+    bool CanReserve(size_t size, bool enforceLimit) const;
+};
@@ -0,0 +1,1466 @@
+#include "lua_binding.h"
+#include "lua_method_stats.h"
+#include "lua_profiler.h"
+#include "lua_tasks.h"
+#include "script_cache.h"
+#include "script_loader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+void CheckThunkArgumentCount(lua_State* L, int expectedLuaArgumentCount)
+{
+    int luaArgumentCount = lua_gettop(L);
+    if (luaArgumentCount != expectedLuaArgumentCount)
+    {
+        luaL_error(L, "lua vs. native argument count mismatch [%d != %d]\n", luaArgumentCount, expectedLuaArgumentCount);
+    }
+}
+
+// Address of this key marks the metatables of bound classes, so userdata created by the binding can be told apart
+// from any other userdata before their memory is read as an rttr::variant.
+constexpr char BoundUserdataMarkerKey = 0;
+
+// Returns the rttr::variant at the start of a userdata created by the binding, or nullptr for any other lua value.
+rttr::variant* GetBoundUserdata(lua_State* L, int luaIndex)
+{
+    if (lua_type(L, luaIndex) != LUA_TUSERDATA || !lua_getmetatable(L, luaIndex))
+    {
+        return nullptr;
+    }
+    bool isBound = lua_rawgetp(L, -1, &BoundUserdataMarkerKey) != LUA_TNIL;
+    constexpr int metatableAndMarkerCount = 2;
+    lua_pop(L, metatableAndMarkerCount);
+    return isBound ? (rttr::variant*) lua_touserdata(L, luaIndex) : nullptr;
+}
+
+struct LuaTypeConverter
+{
+    rttr::variant (* getFromLuaStack)(lua_State* L, int luaIndex);
+    void (* putOnLuaStack)(lua_State* L, const rttr::variant& variant);
+
+    // Reads/writes a native value in place, without going through rttr::variant. Only set for scalar types.
+    void (* copyFromLuaStack)(lua_State* L, int luaIndex, void* destination);
+    void (* copyToLuaStack)(lua_State* L, const void* source);
+
+    // Raises the lua error getFromLuaStack would raise, without creating the value. Not set when any lua value converts.
+    void (* checkOnLuaStack)(lua_State* L, int luaIndex);
+};
+
+void CheckLuaType(lua_State* L, int luaIndex, int expectedLuaType)
+{
+    int luaType = lua_type(L, luaIndex);
+    if (luaType != expectedLuaType)
+    {
+        luaL_error(L, "expected lua type [%s] on lua index [%d] but got [%s]\n", lua_typename(L, expectedLuaType), luaIndex, lua_typename(L, luaType));
+    }
+}
+
+rttr::variant GetBooleanFromLuaStack(lua_State* L, int luaIndex)
+{
+    bool value = lua_toboolean(L, luaIndex);
+    LOG_TRACE("parsed bool [%d]", value);
+    return value;
+}
+
+void PutBooleanOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    bool value = variant.get_value<bool>();
+    LOG_TRACE("pushing [%d] onto lua stack", value);
+    lua_pushboolean(L, value);
+}
+
+void CopyBooleanFromLuaStack(lua_State* L, int luaIndex, void* destination)
+{
+    *(bool*) destination = lua_toboolean(L, luaIndex);
+}
+
+void CopyBooleanToLuaStack(lua_State* L, const void* source)
+{
+    lua_pushboolean(L, *(const bool*) source);
+}
+
+lua_Integer GetLuaInteger(lua_State* L, int luaIndex)
+{
+    int isInteger = 0;
+    lua_Integer value = lua_tointegerx(L, luaIndex, &isInteger);
+    if (!isInteger)
+    {
+        luaL_error(L, "expected integer on lua index [%d] but got [%s]\n", luaIndex, luaL_typename(L, luaIndex));
+    }
+    return value;
+}
+
+void CheckIntegerOnLuaStack(lua_State* L, int luaIndex)
+{
+    GetLuaInteger(L, luaIndex);
+}
+
+template<typename T>
+rttr::variant GetIntegerFromLuaStack(lua_State* L, int luaIndex)
+{
+    auto value = (T) GetLuaInteger(L, luaIndex);
+    LOG_TRACE("parsed integer [%lld]", (long long) value);
+    return value;
+}
+
+template<typename T>
+void PutIntegerOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    auto value = (lua_Integer) variant.get_value<T>();
+    LOG_TRACE("pushing [%lld] onto lua stack", (long long) value);
+    lua_pushinteger(L, value);
+}
+
+template<typename T>
+void CopyIntegerFromLuaStack(lua_State* L, int luaIndex, void* destination)
+{
+    *(T*) destination = (T) GetLuaInteger(L, luaIndex);
+}
+
+template<typename T>
+void CopyIntegerToLuaStack(lua_State* L, const void* source)
+{
+    lua_pushinteger(L, (lua_Integer) *(const T*) source);
+}
+
+lua_Number GetLuaNumber(lua_State* L, int luaIndex)
+{
+    int isNumber = 0;
+    lua_Number value = lua_tonumberx(L, luaIndex, &isNumber);
+    if (!isNumber)
+    {
+        luaL_error(L, "expected number on lua index [%d] but got [%s]\n", luaIndex, luaL_typename(L, luaIndex));
+    }
+    return value;
+}
+
+void CheckNumberOnLuaStack(lua_State* L, int luaIndex)
+{
+    GetLuaNumber(L, luaIndex);
+}
+
+template<typename T>
+rttr::variant GetNumberFromLuaStack(lua_State* L, int luaIndex)
+{
+    lua_Number value = GetLuaNumber(L, luaIndex);
+    LOG_TRACE("parsed number [%f]", (double) value);
+    return (T) value;
+}
+
+template<typename T>
+void PutNumberOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    auto value = (lua_Number) variant.get_value<T>();
+    LOG_TRACE("pushing [%f] onto lua stack", (double) value);
+    lua_pushnumber(L, value);
+}
+
+template<typename T>
+void CopyNumberFromLuaStack(lua_State* L, int luaIndex, void* destination)
+{
+    *(T*) destination = (T) GetLuaNumber(L, luaIndex);
+}
+
+template<typename T>
+void CopyNumberToLuaStack(lua_State* L, const void* source)
+{
+    lua_pushnumber(L, (lua_Number) *(const T*) source);
+}
+
+void CheckStringOnLuaStack(lua_State* L, int luaIndex)
+{
+    CheckLuaType(L, luaIndex, LUA_TSTRING);
+}
+
+rttr::variant GetCStringFromLuaStack(lua_State* L, int luaIndex)
+{
+    CheckLuaType(L, luaIndex, LUA_TSTRING);
+    const char* value = lua_tostring(L, luaIndex);
+    LOG_TRACE("parsed string [%s]", value);
+    return value;
+}
+
+void PutCStringOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    const char* value = variant.get_value<const char*>();
+    LOG_TRACE("pushing [%s] onto lua stack", value);
+    lua_pushstring(L, value);
+}
+
+// The view points into the lua string itself, so it stays valid for as long as the string is on the lua stack.
+std::string_view GetStringViewFromLuaStack(lua_State* L, int luaIndex)
+{
+    CheckLuaType(L, luaIndex, LUA_TSTRING);
+    size_t length = 0;
+    const char* value = lua_tolstring(L, luaIndex, &length);
+    LOG_TRACE("parsed string [%.*s]", (int) length, value);
+    return {value, length};
+}
+
+template<typename T>
+rttr::variant GetStringFromLuaStack(lua_State* L, int luaIndex)
+{
+    return T(GetStringViewFromLuaStack(L, luaIndex));
+}
+
+template<typename T>
+void PutStringOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    const T& value = variant.get_value<T>();
+    LOG_TRACE("pushing [%.*s] onto lua stack", LOG_STRING_VIEW(value));
+    lua_pushlstring(L, value.data(), value.size());
+}
+
+rttr::variant GetAwaitFromLuaStack(lua_State* L, int luaIndex)
+{
+    return LuaAwait{(LuaTaskRunner::OperationId) GetLuaInteger(L, luaIndex)};
+}
+
+void PutAwaitOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    lua_pushinteger(L, (lua_Integer) variant.get_value<LuaAwait>().operationId);
+}
+
+template<typename T>
+std::pair<rttr::type, LuaTypeConverter> CreateIntegerConverter()
+{
+    return {rttr::type::get<T>(), {GetIntegerFromLuaStack<T>, PutIntegerOnLuaStack<T>, CopyIntegerFromLuaStack<T>, CopyIntegerToLuaStack<T>, CheckIntegerOnLuaStack}};
+}
+
+template<typename T>
+std::pair<rttr::type, LuaTypeConverter> CreateNumberConverter()
+{
+    return {rttr::type::get<T>(), {GetNumberFromLuaStack<T>, PutNumberOnLuaStack<T>, CopyNumberFromLuaStack<T>, CopyNumberToLuaStack<T>, CheckNumberOnLuaStack}};
+}
+
+template<typename T>
+std::pair<rttr::type, LuaTypeConverter> CreateStringConverter()
+{
+    return {rttr::type::get<T>(), {GetStringFromLuaStack<T>, PutStringOnLuaStack<T>, nullptr, nullptr, CheckStringOnLuaStack}};
+}
+
+const LuaTypeConverter* FindLuaTypeConverter(const rttr::type& type)
+{
+    static const std::unordered_map<rttr::type, LuaTypeConverter> converters = {
+            {rttr::type::get<bool>(), {GetBooleanFromLuaStack, PutBooleanOnLuaStack, CopyBooleanFromLuaStack, CopyBooleanToLuaStack, nullptr}},
+            CreateIntegerConverter<char>(),
+            CreateIntegerConverter<signed char>(),
+            CreateIntegerConverter<unsigned char>(),
+            CreateIntegerConverter<short>(),
+            CreateIntegerConverter<unsigned short>(),
+            CreateIntegerConverter<int>(),
+            CreateIntegerConverter<unsigned int>(),
+            CreateIntegerConverter<long>(),
+            CreateIntegerConverter<unsigned long>(),
+            CreateIntegerConverter<long long>(),
+            CreateIntegerConverter<unsigned long long>(),
+            CreateNumberConverter<float>(),
+            CreateNumberConverter<double>(),
+            CreateNumberConverter<long double>(),
+            {rttr::type::get<const char*>(), {GetCStringFromLuaStack, PutCStringOnLuaStack, nullptr, nullptr, CheckStringOnLuaStack}},
+            CreateStringConverter<std::string>(),
+            CreateStringConverter<std::string_view>(),
+            {rttr::type::get<LuaAwait>(), {GetAwaitFromLuaStack, PutAwaitOnLuaStack, nullptr, nullptr, CheckIntegerOnLuaStack}},
+    };
+    auto iterator = converters.find(type);
+    return iterator != converters.end() ? &iterator->second : nullptr;
+}
+
+// Enums are passed from lua either by their registered name or by their integer value, and are put on the lua stack as integers.
+rttr::variant GetEnumFromLuaStack(lua_State* L, int luaIndex, const rttr::type& type)
+{
+    const rttr::enumeration& enumeration = type.get_enumeration();
+    if (lua_type(L, luaIndex) == LUA_TSTRING)
+    {
+        size_t length = 0;
+        const char* name = lua_tolstring(L, luaIndex, &length);
+        rttr::variant value = enumeration.name_to_value(rttr::string_view(name, length));
+        if (!value.is_valid())
+        {
+            const std::string& typeName = type.get_name().to_string();
+            luaL_error(L, "unknown name [%s] for enum [%s]\n", name, typeName.c_str());
+        }
+        return value;
+    }
+    lua_Integer integer = GetLuaInteger(L, luaIndex);
+    for (const auto& value : enumeration.get_values())
+    {
+        if (value.to_int64() == integer)
+        {
+            return value;
+        }
+    }
+    const std::string& typeName = type.get_name().to_string();
+    luaL_error(L, "unknown value [%I] for enum [%s]\n", integer, typeName.c_str());
+    return {};
+}
+
+rttr::variant GetFromLuaStack(lua_State* L, int luaIndex, const rttr::type& type)
+{
+    const LuaTypeConverter* converter = FindLuaTypeConverter(type);
+    if (converter != nullptr)
+    {
+        return converter->getFromLuaStack(L, luaIndex);
+    }
+    if (type.is_enumeration())
+    {
+        return GetEnumFromLuaStack(L, luaIndex, type);
+    }
+    const std::string& typeName = type.get_name().to_string();
+    luaL_error(L, "unknown native type [%s] for lua type [%s]\n", typeName.c_str(), luaL_typename(L, luaIndex));
+    return {};
+}
+
+// Raises the lua error GetFromLuaStack would raise for the value, without creating the value.
+void CheckFromLuaStack(lua_State* L, int luaIndex, const rttr::type& type)
+{
+    const LuaTypeConverter* converter = FindLuaTypeConverter(type);
+    if (converter != nullptr)
+    {
+        if (converter->checkOnLuaStack != nullptr)
+        {
+            converter->checkOnLuaStack(L, luaIndex);
+        }
+        return;
+    }
+    if (type.is_enumeration())
+    {
+        // Enums are held by rttr::variant inline, so there is nothing a lua error could leak
+        GetEnumFromLuaStack(L, luaIndex, type);
+        return;
+    }
+    const std::string& typeName = type.get_name().to_string();
+    luaL_error(L, "unknown native type [%s] for lua type [%s]\n", typeName.c_str(), luaL_typename(L, luaIndex));
+}
+
+// std::string_view does not fit in the small buffer of rttr::variant, so string views are kept next to the variant
+// and handed to rttr::argument directly to avoid allocating for every string argument.
+struct ArgumentValue
+{
+    rttr::variant variant;
+    std::string_view stringView;
+};
+
+// The most arguments rttr::method forwards directly, more than that go through a vector anyway
+constexpr int InlineArgumentCapacity = 6;
+
+int PutOnLuaStack(lua_State* L, const rttr::variant& variant)
+{
+    LOG_TRACE("putting value of type [%.*s] on lua stack", LOG_STRING_VIEW(variant.get_type().get_name()));
+
+    int returnValueCount = 0;
+    if (!variant.is_type<void>())
+    {
+        const LuaTypeConverter* converter = FindLuaTypeConverter(variant.get_type());
+        if (converter != nullptr)
+        {
+            converter->putOnLuaStack(L, variant);
+            returnValueCount++;
+        }
+        else if (variant.get_type().is_enumeration())
+        {
+            auto value = (lua_Integer) variant.to_int64();
+            LOG_TRACE("pushing enum [%lld] onto lua stack", (long long) value);
+            lua_pushinteger(L, value);
+            returnValueCount++;
+        }
+        else if (variant.get_type().is_class() || variant.get_type().is_pointer())
+        {
+            returnValueCount = CreateUserdata(L, variant);
+        }
+        else
+        {
+            const std::string& typeName = variant.get_type().get_name().to_string();
+            luaL_error(L, "could not put value of unsupported type [%s] on lua stack\n", typeName.c_str());
+        }
+    }
+    LOG_TRACE("put [%d] values of type [%.*s] on lua stack", returnValueCount, LOG_STRING_VIEW(variant.get_type().get_name()));
+    return returnValueCount;
+}
+
+int GetMethodArgumentCount(lua_State* L, const rttr::array_range<rttr::parameter_info>& argumentInfos)
+{
+    int luaArgumentCount = 0;
+    for (int i = lua_gettop(L); i > 0; i--)
+    {
+        if (lua_isuserdata(L, i))
+        {
+            break;
+        }
+        luaArgumentCount++;
+    }
+    int nativeArgumentCount = argumentInfos.size();
+    if (luaArgumentCount != nativeArgumentCount)
+    {
+        luaL_error(L, "lua vs. native argument count mismatch [%d != %d]\n", luaArgumentCount, nativeArgumentCount);
+    }
+    return luaArgumentCount;
+}
+
+rttr::variant InvokeWithArguments(const rttr::method& method, const rttr::instance& instance, rttr::argument* arguments, int argumentCount)
+{
+    switch (argumentCount)
+    {
+        case 0:
+            return method.invoke(instance);
+        case 1:
+            return method.invoke(instance, arguments[0]);
+        case 2:
+            return method.invoke(instance, arguments[0], arguments[1]);
+        case 3:
+            return method.invoke(instance, arguments[0], arguments[1], arguments[2]);
+        case 4:
+            return method.invoke(instance, arguments[0], arguments[1], arguments[2], arguments[3]);
+        case 5:
+            return method.invoke(instance, arguments[0], arguments[1], arguments[2], arguments[3], arguments[4]);
+        case 6:
+            return method.invoke(instance, arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5]);
+        default:
+            // rttr::method only forwards up to six arguments directly, anything beyond that has to go through a vector
+            return method.invoke_variadic(instance, std::vector<rttr::argument>(arguments, arguments + argumentCount));
+    }
+}
+
+// Holds the arguments of a call inline for up to InlineArgumentCapacity arguments. Only the slots of the arguments of the
+// call are constructed, since constructing unused slots is not free.
+struct ArgumentBuffer
+{
+    static_assert(alignof(ArgumentValue) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__ && sizeof(ArgumentValue) % alignof(rttr::argument) == 0);
+
+    alignas(ArgumentValue) unsigned char inlineArgumentValueStorage[InlineArgumentCapacity * sizeof(ArgumentValue)];
+    alignas(rttr::argument) unsigned char inlineArgumentStorage[InlineArgumentCapacity * sizeof(rttr::argument)];
+    std::unique_ptr<unsigned char[]> heapStorage;
+    ArgumentValue* argumentValues = (ArgumentValue*) inlineArgumentValueStorage;
+    rttr::argument* arguments = (rttr::argument*) inlineArgumentStorage;
+    int argumentValueCount = 0;
+
+    ArgumentBuffer() = default;
+
+    ~ArgumentBuffer()
+    {
+        for (int i = 0; i < argumentValueCount; i++)
+        {
+            argumentValues[i].~ArgumentValue();
+        }
+    }
+
+    ArgumentBuffer(const ArgumentBuffer&) = delete;
+
+    ArgumentBuffer& operator=(const ArgumentBuffer&) = delete;
+
+    void Reserve(int argumentCount)
+    {
+        if (argumentCount > InlineArgumentCapacity)
+        {
+            LOG_TRACE("[%d] arguments exceed inline capacity [%d], allocating argument buffers", argumentCount, InlineArgumentCapacity);
+            heapStorage = std::make_unique<unsigned char[]>(argumentCount * (sizeof(ArgumentValue) + sizeof(rttr::argument)));
+            argumentValues = (ArgumentValue*) heapStorage.get();
+            arguments = (rttr::argument*) (heapStorage.get() + argumentCount * sizeof(ArgumentValue));
+        }
+    }
+};
+
+// Every argument is checked before any of them is read into the buffer, since a lua error would skip the destructor
+// of the buffer and leak what the arguments read so far hold (e.g. std::string) as well as the heap storage.
+void GetArgumentsFromLuaStack(lua_State* L, const rttr::array_range<rttr::parameter_info>& argumentInfos, int firstArgumentLuaIndex, ArgumentBuffer& argumentBuffer)
+{
+    int argumentCount = (int) argumentInfos.size();
+    auto checkedArgumentInfoIterator = argumentInfos.begin();
+    for (int i = 0; i < argumentCount; i++, checkedArgumentInfoIterator++)
+    {
+        int luaIndex = firstArgumentLuaIndex + i;
+        LOG_TRACE("checking argument on lua index [%d] of lua type [%s] and native type [%.*s]", luaIndex, luaL_typename(L, luaIndex),
+                  LOG_STRING_VIEW(checkedArgumentInfoIterator->get_type().get_name()));
+        CheckFromLuaStack(L, luaIndex, checkedArgumentInfoIterator->get_type());
+    }
+
+    argumentBuffer.Reserve(argumentCount);
+    ArgumentValue* argumentValues = argumentBuffer.argumentValues;
+    rttr::argument* arguments = argumentBuffer.arguments;
+    auto argumentInfoIterator = argumentInfos.begin();
+    for (int i = 0; i < argumentCount; i++, argumentInfoIterator++)
+    {
+        int luaIndex = firstArgumentLuaIndex + i;
+        const rttr::type& argumentType = argumentInfoIterator->get_type();
+        if (argumentType == rttr::type::get<std::string_view>())
+        {
+            new(&argumentValues[i]) ArgumentValue{{}, GetStringViewFromLuaStack(L, luaIndex)};
+            argumentBuffer.argumentValueCount++;
+            new(&arguments[i]) rttr::argument(argumentValues[i].stringView);
+        }
+        else
+        {
+            new(&argumentValues[i]) ArgumentValue{GetFromLuaStack(L, luaIndex, argumentType), {}};
+            argumentBuffer.argumentValueCount++;
+            new(&arguments[i]) rttr::argument(argumentValues[i].variant);
+        }
+    }
+}
+
+// Reports a call of a bound native method that started at startTime and just returned to the profiler of the lua state.
+void AddProfilerNativeCall(LuaProfiler& profiler, lua_State* L, const rttr::method& method, uint64_t startTime)
+{
+    const rttr::string_view& methodName = method.get_name();
+    profiler.AddNativeCall(L, std::string_view(methodName.data(), methodName.size()), startTime);
+}
+
+// Reports a call of a bound native method to the method stats of the lua state. Reading the arguments started at
+// startTime, the native method ran from bodyStartTime to bodyEndTime and putting the results on the lua stack ended now.
+void AddMethodStatsCall(LuaMethodStats& methodStats, const rttr::method& method, uint64_t startTime, uint64_t bodyStartTime, uint64_t bodyEndTime)
+{
+    uint64_t bodyTime = bodyEndTime - bodyStartTime;
+    methodStats.AddCall(method, LuaProfiler::GetTime() - startTime - bodyTime, bodyTime);
+}
+
+int InvokeMethod(lua_State* L, const rttr::method& method, const rttr::instance& instance)
+{
+    LuaMethodStats* methodStats = LuaMethodStats::Find(L);
+    uint64_t startTime = methodStats != nullptr ? LuaProfiler::GetTime() : 0;
+    LOG_TRACE("getting arguments for method [%.*s]", LOG_STRING_VIEW(method.get_name()));
+
+    const rttr::array_range<rttr::parameter_info>& argumentInfos = method.get_parameter_infos();
+    int argumentCount = GetMethodArgumentCount(L, argumentInfos);
+    LOG_TRACE("getting [%d] arguments for method [%.*s]", argumentCount, LOG_STRING_VIEW(method.get_name()));
+
+    LuaProfiler* profiler = LuaProfiler::Find(L);
+    bool isTimed = profiler != nullptr || methodStats != nullptr;
+    uint64_t nativeCallStartTime = 0;
+    uint64_t nativeCallEndTime = 0;
+    rttr::variant result;
+    {
+        // Destroyed before any lua error below is raised
+        ArgumentBuffer argumentBuffer;
+        int firstArgumentLuaIndex = lua_gettop(L) - argumentCount + 1;
+        GetArgumentsFromLuaStack(L, argumentInfos, firstArgumentLuaIndex, argumentBuffer);
+        nativeCallStartTime = isTimed ? LuaProfiler::GetTime() : 0;
+        result = InvokeWithArguments(method, instance, argumentBuffer.arguments, argumentCount);
+        nativeCallEndTime = isTimed ? LuaProfiler::GetTime() : 0;
+    }
+    if (profiler != nullptr)
+    {
+        AddProfilerNativeCall(*profiler, L, method, nativeCallStartTime);
+    }
+    if (!result.is_valid())
+    {
+        const std::string& methodName = method.get_name().to_string();
+        luaL_error(L, "could not invoke method [%s] with [%d] arguments\n", methodName.c_str(), argumentCount);
+    }
+    LOG_TRACE("invoked method [%.*s] with [%d] arguments", LOG_STRING_VIEW(method.get_name()), argumentCount);
+    LOG_TRACE("return type from method [%.*s] is [%.*s]", LOG_STRING_VIEW(method.get_name()), LOG_STRING_VIEW(result.get_type().get_name()));
+
+    int returnValueCount = PutOnLuaStack(L, result);
+    LOG_TRACE("returning [%d] values of type [%.*s] from method [%.*s]", returnValueCount, LOG_STRING_VIEW(result.get_type().get_name()),
+              LOG_STRING_VIEW(method.get_name()));
+    if (methodStats != nullptr)
+    {
+        AddMethodStatsCall(*methodStats, method, startTime, nativeCallStartTime, nativeCallEndTime);
+    }
+    return returnValueCount;
+}
+
+int InvokeGlobalMethod(lua_State* L)
+{
+    LOG_TRACE("invoking global method from lua");
+
+    const auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
+    LOG_TRACE("invoking global method [%.*s]", LOG_STRING_VIEW(method.get_name()));
+
+    rttr::instance instance;
+    return InvokeMethod(L, method, instance);
+}
+
+std::string GetMetatableName(const rttr::type& type)
+{
+    std::string typeName;
+    if (type.is_pointer())
+    {
+        typeName = type.get_raw_type().get_name().to_string();
+    }
+    else
+    {
+        typeName = type.get_name().to_string();
+    }
+    return typeName.append("__metatable");
+}
+
+// Userdata with inline storage hold the rttr::variant referencing the object first, followed by the object itself.
+size_t GetInlineObjectOffset(const LuaInlineStorage& inlineStorage)
+{
+    size_t alignment = inlineStorage.alignment;
+    return (sizeof(rttr::variant) + alignment - 1) / alignment * alignment;
+}
+
+int CreateUserdata(lua_State* L)
+{
+    LOG_TRACE("creating userdata (i.e. native type) from lua");
+
+    const auto& type = *(rttr::type*) lua_touserdata(L, lua_upvalueindex(1));
+    LOG_TRACE("creating userdata for type [%.*s]", LOG_STRING_VIEW(type.get_name()));
+
+    const auto* inlineStorage = (const LuaInlineStorage*) lua_touserdata(L, lua_upvalueindex(3));
+    if (inlineStorage != nullptr)
+    {
+        size_t objectOffset = GetInlineObjectOffset(*inlineStorage);
+        void* userdata = lua_newuserdata(L, objectOffset + type.get_sizeof());
+        void* object = (unsigned char*) userdata + objectOffset;
+        inlineStorage->construct(object);
+        new(userdata) rttr::variant(inlineStorage->createReference(object));
+    }
+    else
+    {
+        void* userdata = lua_newuserdata(L, sizeof(rttr::variant));
+        new(userdata) rttr::variant(type.create());
+    }
+    int userdataIndex = lua_gettop(L);
+    LOG_TRACE("created userdata on lua index [%d] for type [%.*s]", userdataIndex, LOG_STRING_VIEW(type.get_name()));
+
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_setmetatable(L, userdataIndex);
+    LOG_TRACE("bound metatable to userdata on lua index [%d] for type [%.*s]", userdataIndex, LOG_STRING_VIEW(type.get_name()));
+
+    constexpr int createdCount = 1;
+    return createdCount;
+}
+
+int CreateUserdata(lua_State* L, const rttr::variant& variant)
+{
+    LOG_TRACE("creating native type from lua");
+
+    rttr::type type = variant.get_type();
+    LOG_TRACE("creating type [%.*s]", LOG_STRING_VIEW(type.get_name()));
+
+    void* userdata = lua_newuserdata(L, sizeof(rttr::variant));
+    new(userdata) rttr::variant(variant);
+    int userdataIndex = lua_gettop(L);
+    LOG_TRACE("created userdata on lua index [%d] for type [%.*s]", userdataIndex, LOG_STRING_VIEW(type.get_name()));
+
+    const std::string& metatableName = GetMetatableName(type);
+    luaL_getmetatable(L, metatableName.c_str());
+    lua_setmetatable(L, userdataIndex);
+    LOG_TRACE("bound metatable [%s] to userdata on lua index [%d] for type [%.*s]", metatableName.c_str(), userdataIndex, LOG_STRING_VIEW(type.get_name()));
+
+    constexpr int createdCount = 1;
+    return createdCount;
+}
+
+int DestroyUserdata(lua_State* L)
+{
+    LOG_TRACE("destroying native type from lua");
+    void* userdata = lua_touserdata(L, -1);
+    auto& variant = *(rttr::variant*) userdata;
+    LOG_TRACE("destroying native type [%.*s]", LOG_STRING_VIEW(variant.get_type().get_name()));
+
+    // Only userdata created from lua hold their object inline, the ones wrapping native values are just a variant
+    const auto* inlineStorage = (const LuaInlineStorage*) lua_touserdata(L, lua_upvalueindex(1));
+    if (inlineStorage != nullptr && lua_rawlen(L, -1) > sizeof(rttr::variant))
+    {
+        LOG_TRACE("destroying inline object of native type [%.*s]", LOG_STRING_VIEW(variant.get_type().get_name()));
+        inlineStorage->destroy((unsigned char*) userdata + GetInlineObjectOffset(*inlineStorage));
+    }
+    variant.~variant();
+    return 0;
+}
+
+int InvokeMethodOnUserdata(lua_State* L)
+{
+    LOG_TRACE("invoking method on userdata");
+
+    auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
+    LOG_TRACE("invoking method [%.*s] on userdata", LOG_STRING_VIEW(method.get_name()));
+
+    constexpr int bottomOfLuaStackIndex = 1;
+    int userdataIndex = bottomOfLuaStackIndex;
+    const rttr::variant* userdata = GetBoundUserdata(L, userdataIndex);
+    if (userdata == nullptr)
+    {
+        const std::string& methodName = method.get_name().to_string();
+        luaL_error(L, "expected bound userdata on lua index [%d] when invoking method [%s]\n", userdataIndex, methodName.c_str());
+    }
+    const rttr::variant& variant = *userdata;
+    LOG_TRACE("invoking method [%.*s] on userdata of type [%.*s]", LOG_STRING_VIEW(method.get_name()), LOG_STRING_VIEW(variant.get_type().get_name()));
+
+    rttr::instance instance(variant);
+    return InvokeMethod(L, method, instance);
+}
+
+// Invokes one method on every userdata in a lua array, e.g. Sprite.Move_batch(sprites, 1, 1), so the arguments are
+// parsed and the method is resolved once for the whole batch instead of once per instance.
+int InvokeMethodOnUserdataBatch(lua_State* L)
+{
+    LOG_TRACE("invoking method on batch of userdata");
+
+    auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
+    LOG_TRACE("invoking method [%.*s] on batch of userdata", LOG_STRING_VIEW(method.get_name()));
+
+    constexpr int bottomOfLuaStackIndex = 1;
+    int instancesIndex = bottomOfLuaStackIndex;
+    if (!lua_istable(L, instancesIndex))
+    {
+        const std::string& methodName = method.get_name().to_string();
+        luaL_error(L, "expected table of userdata on lua index [%d] when invoking method [%s] on batch\n", instancesIndex, methodName.c_str());
+    }
+
+    const rttr::array_range<rttr::parameter_info>& argumentInfos = method.get_parameter_infos();
+    int argumentCount = lua_gettop(L) - instancesIndex;
+    int nativeArgumentCount = (int) argumentInfos.size();
+    if (argumentCount != nativeArgumentCount)
+    {
+        luaL_error(L, "lua vs. native argument count mismatch [%d != %d]\n", argumentCount, nativeArgumentCount);
+    }
+    auto instanceCount = (lua_Integer) lua_rawlen(L, instancesIndex);
+    LOG_TRACE("invoking method [%.*s] with [%d] arguments on [%lld] userdata", LOG_STRING_VIEW(method.get_name()), argumentCount, (long long) instanceCount);
+
+    // Every instance counts as a call, the first one includes reading the shared arguments
+    LuaProfiler* profiler = LuaProfiler::Find(L);
+    LuaMethodStats* methodStats = LuaMethodStats::Find(L);
+    bool isTimed = profiler != nullptr || methodStats != nullptr;
+    uint64_t startTime = methodStats != nullptr ? LuaProfiler::GetTime() : 0;
+    lua_Integer failedIndex = 0;
+    {
+        // Destroyed before the lua error for a failed instance is raised
+        ArgumentBuffer argumentBuffer;
+        GetArgumentsFromLuaStack(L, argumentInfos, instancesIndex + 1, argumentBuffer);
+        for (lua_Integer i = 1; i <= instanceCount; i++)
+        {
+            if (methodStats != nullptr && i > 1)
+            {
+                startTime = LuaProfiler::GetTime();
+            }
+            lua_rawgeti(L, instancesIndex, i);
+            rttr::variant* variant = GetBoundUserdata(L, -1);
+            if (variant == nullptr)
+            {
+                failedIndex = i;
+                break;
+            }
+            rttr::instance instance(*variant);
+            uint64_t bodyStartTime = isTimed ? LuaProfiler::GetTime() : 0;
+            const rttr::variant& result = InvokeWithArguments(method, instance, argumentBuffer.arguments, argumentCount);
+            uint64_t bodyEndTime = isTimed ? LuaProfiler::GetTime() : 0;
+            if (profiler != nullptr)
+            {
+                AddProfilerNativeCall(*profiler, L, method, bodyStartTime);
+            }
+            if (!result.is_valid())
+            {
+                failedIndex = i;
+                break;
+            }
+            lua_pop(L, 1);
+            if (methodStats != nullptr)
+            {
+                AddMethodStatsCall(*methodStats, method, startTime, bodyStartTime, bodyEndTime);
+            }
+        }
+    }
+    if (failedIndex != 0)
+    {
+        const std::string& methodName = method.get_name().to_string();
+        if (GetBoundUserdata(L, -1) == nullptr)
+        {
+            luaL_error(L, "expected bound userdata on batch index [%I] when invoking method [%s] on batch but got [%s]\n", failedIndex, methodName.c_str(),
+                       luaL_typename(L, -1));
+        }
+        luaL_error(L, "could not invoke method [%s] on batch index [%I]\n", methodName.c_str(), failedIndex);
+    }
+    return 0;
+}
+
+int IndexUserdata(lua_State* L)
+{
+    LOG_TRACE("indexing userdata from lua");
+
+    const char* typeName = (const char*) lua_tostring(L, lua_upvalueindex(1));
+    constexpr int methodsUpvalueIndex = 2;
+    constexpr int fieldsUpvalueIndex = 3;
+    constexpr int propertiesUpvalueIndex = 4;
+    LOG_TRACE("indexing userdata of type [%s]", typeName);
+
+    constexpr int bottomOfLuaStackIndex = 1;
+    int userdataIndex = bottomOfLuaStackIndex;
+    int keyIndex = userdataIndex + 1;
+
+    const rttr::variant* instance = GetBoundUserdata(L, userdataIndex);
+    if (instance == nullptr)
+    {
+        luaL_error(L, "expected bound userdata on lua index [%d] when indexing userdata of type [%s]\n", userdataIndex, typeName);
+    }
+    if (!lua_isstring(L, keyIndex))
+    {
+        luaL_error(L, "expected name of a native property or method on lua index [%d] when indexing userdata of type [%s]\n", keyIndex, typeName);
+    }
+    LOG_TRACE("indexing userdata of type [%s] by key [%s]", typeName, lua_tostring(L, keyIndex));
+
+    lua_pushvalue(L, keyIndex);
+    if (lua_rawget(L, lua_upvalueindex(methodsUpvalueIndex)) != LUA_TNIL)
+    {
+        LOG_TRACE("returning cached closure for method [%s] to be invoked on userdata of type [%s]", lua_tostring(L, keyIndex), typeName);
+        int indexedMethodsCount = 1;
+        return indexedMethodsCount;
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, keyIndex);
+    if (lua_rawget(L, lua_upvalueindex(fieldsUpvalueIndex)) != LUA_TNIL)
+    {
+        const auto& field = *(const LuaField*) lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        LOG_TRACE("reading field [%s] from userdata of type [%s]", lua_tostring(L, keyIndex), typeName);
+
+        int indexedFieldsCount = field.putOnLuaStack(L, *instance);
+        return indexedFieldsCount;
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, keyIndex);
+    if (lua_rawget(L, lua_upvalueindex(propertiesUpvalueIndex)) != LUA_TNIL)
+    {
+        const auto& property = *(rttr::property*) lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        LOG_TRACE("found property [%.*s] to read from userdata of type [%s]", LOG_STRING_VIEW(property.get_name()), typeName);
+
+        const rttr::variant& propertyValue = property.get_value(*instance);
+        LOG_TRACE("reading property [%.*s] of type [%.*s] from userdata of type [%s]", LOG_STRING_VIEW(property.get_name()),
+                  LOG_STRING_VIEW(propertyValue.get_type().get_name()), typeName);
+
+        int indexedPropertiesCount = PutOnLuaStack(L, propertyValue);
+        return indexedPropertiesCount;
+    }
+    lua_pop(L, 1);
+
+    LOG_TRACE("getting uservalue (i.e. table) for userdata on index [%d]", userdataIndex);
+    if (lua_getuservalue(L, userdataIndex) != LUA_TTABLE)
+    {
+        LOG_TRACE("userdata on index [%d] has no uservalue (i.e. table) yet, returning nil", userdataIndex);
+        lua_pushnil(L);
+        int indexedValuesCount = 1;
+        return indexedValuesCount;
+    }
+
+    LOG_TRACE("getting key for value in table on index [%d]", keyIndex);
+    lua_pushvalue(L, keyIndex);
+
+    LOG_TRACE("getting value on key in table");
+    lua_gettable(L, -2);
+
+    LOG_TRACE("returning value found on key on index [%d] in uservalue (i.e. table) on index [%d]", keyIndex, userdataIndex);
+    int indexedValuesCount = 1;
+    return indexedValuesCount;
+}
+
+int NewIndexOnUserdata(lua_State* L)
+{
+    LOG_TRACE("indexing type by unknown key from lua");
+
+    const char* typeName = (const char*) lua_tostring(L, lua_upvalueindex(1));
+    constexpr int fieldsUpvalueIndex = 2;
+    constexpr int propertiesUpvalueIndex = 3;
+    LOG_TRACE("indexing type [%s] by unknown key", typeName);
+
+    constexpr int bottomOfLuaStackIndex = 1;
+    int userdataIndex = bottomOfLuaStackIndex;
+    int keyIndex = userdataIndex + 1;
+    int valueIndex = keyIndex + 1;
+
+    const rttr::variant* userdata = GetBoundUserdata(L, userdataIndex);
+    if (userdata == nullptr)
+    {
+        luaL_error(L, "expected bound userdata on lua index [%d] when indexing type [%s]\n", userdataIndex, typeName);
+    }
+    const rttr::variant& instance = *userdata;
+    if (!lua_isstring(L, keyIndex))
+    {
+        luaL_error(L, "expected name of a native property or method on lua index [%d] when indexing type [%s]\n", keyIndex, typeName);
+    }
+
+    lua_pushvalue(L, keyIndex);
+    if (lua_rawget(L, lua_upvalueindex(fieldsUpvalueIndex)) != LUA_TNIL)
+    {
+        const auto& field = *(const LuaField*) lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        LOG_TRACE("writing value of lua type [%s] to field [%s] on type [%s]", luaL_typename(L, valueIndex), lua_tostring(L, keyIndex), typeName);
+
+        field.getFromLuaStack(L, valueIndex, instance);
+        return 0;
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, keyIndex);
+    if (lua_rawget(L, lua_upvalueindex(propertiesUpvalueIndex)) != LUA_TNIL)
+    {
+        const auto& property = *(rttr::property*) lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        LOG_TRACE("found property [%.*s] to write to on type [%s]", LOG_STRING_VIEW(property.get_name()), typeName);
+
+        LOG_TRACE("writing to property [%.*s] on instance of type [%.*s]", LOG_STRING_VIEW(property.get_name()), LOG_STRING_VIEW(instance.get_type().get_name()));
+
+        LOG_TRACE("writing value of lua type [%s] to property [%.*s] on instance of type [%.*s]", luaL_typename(L, valueIndex),
+                  LOG_STRING_VIEW(property.get_name()), LOG_STRING_VIEW(instance.get_type().get_name()));
+
+        const rttr::variant& value = GetFromLuaStack(L, valueIndex, property.get_type());
+        bool didSetValueOnProperty = property.set_value(instance, value);
+        if (!didSetValueOnProperty)
+        {
+            const std::string& propertyName = property.get_name().to_string();
+            luaL_error(L, "could not set value on property [%s] on type [%s]\n", propertyName.c_str(), typeName);
+        }
+        return 0;
+    }
+    lua_pop(L, 1);
+
+    LOG_TRACE("getting uservalue (i.e. table) for userdata on index [%d]", userdataIndex);
+    if (lua_getuservalue(L, userdataIndex) != LUA_TTABLE)
+    {
+        // Most userdata never get a dynamic field, so the table is only created on the first write
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, userdataIndex);
+        LOG_TRACE("bound a new table to userdata on lua index [%d]", userdataIndex);
+    }
+
+    LOG_TRACE("getting key [%s] for value in table on index [%d]", lua_tostring(L, keyIndex), keyIndex);
+    lua_pushvalue(L, keyIndex);
+
+    LOG_TRACE("getting value for key [%s] in table on index [%d]", lua_tostring(L, keyIndex), valueIndex);
+    lua_pushvalue(L, valueIndex);
+
+    LOG_TRACE("setting value on index [%d] on key on index [%d] on uservalue (i.e. table) on index [%d]", valueIndex, keyIndex, userdataIndex);
+    lua_settable(L, -3);
+
+    int valuesIndexedCount = 1;
+    return valuesIndexedCount;
+}
+
+int PutMethodArgumentsOnLuaStack(lua_State* /* L */)
+{
+    return 0;
+}
+
+void CallLuaMethodOnLuaStack(lua_State* L, const char* methodName, int argumentCount, int resultsCount)
+{
+    constexpr int messageHandlerIndex = 0;
+    if (lua_pcall(L, argumentCount, resultsCount, messageHandlerIndex) != LUA_OK)
+    {
+        luaL_error(L, "could not call method [%s]: %s", methodName, lua_tostring(L, -1));
+    }
+}
+
+struct ComponentPoolColumnView
+{
+    ComponentPool* pool;
+    ComponentPool::Column* column;
+    const LuaTypeConverter* converter;
+};
+
+constexpr const char* ComponentPoolMetatableName = "ComponentPool__metatable";
+constexpr const char* ComponentPoolColumnMetatableName = "ComponentPoolColumn__metatable";
+
+std::string GetComponentPoolName(const rttr::type& type)
+{
+    return type.get_name().to_string().append("__pool");
+}
+
+// Pools are owned by the lua state they were created for and live until it is closed.
+ComponentPool* GetComponentPool(lua_State* L, const rttr::type& type)
+{
+    const std::string& poolName = GetComponentPoolName(type);
+    lua_getfield(L, LUA_REGISTRYINDEX, poolName.c_str());
+    auto* pool = (ComponentPool*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return pool;
+}
+
+ComponentPool::Handle GetComponentPoolHandle(lua_State* L, const ComponentPool& pool, int luaIndex)
+{
+    auto handle = (ComponentPool::Handle) GetLuaInteger(L, luaIndex);
+    if (!pool.IsValid(handle))
+    {
+        const std::string& typeName = pool.GetType().get_name().to_string();
+        luaL_error(L, "invalid handle [%I] for pool of type [%s]\n", (lua_Integer) handle, typeName.c_str());
+    }
+    return handle;
+}
+
+int CreateComponentPoolInstance(lua_State* L)
+{
+    auto& pool = *(ComponentPool*) lua_touserdata(L, lua_upvalueindex(1));
+    ComponentPool::Handle handle = pool.Create();
+    LOG_TRACE("created instance [%llu] in pool of type [%.*s]", (unsigned long long) handle, LOG_STRING_VIEW(pool.GetType().get_name()));
+    lua_pushinteger(L, (lua_Integer) handle);
+    constexpr int createdCount = 1;
+    return createdCount;
+}
+
+int DestroyComponentPoolInstance(lua_State* L)
+{
+    auto& pool = *(ComponentPool*) lua_touserdata(L, lua_upvalueindex(1));
+    auto handle = (ComponentPool::Handle) GetLuaInteger(L, 1);
+    LOG_TRACE("destroying instance [%llu] in pool of type [%.*s]", (unsigned long long) handle, LOG_STRING_VIEW(pool.GetType().get_name()));
+    lua_pushboolean(L, pool.Destroy(handle));
+    return 1;
+}
+
+int IsValidComponentPoolInstance(lua_State* L)
+{
+    auto& pool = *(ComponentPool*) lua_touserdata(L, lua_upvalueindex(1));
+    lua_pushboolean(L, pool.IsValid((ComponentPool::Handle) GetLuaInteger(L, 1)));
+    return 1;
+}
+
+int GetComponentPoolSize(lua_State* L)
+{
+    auto& pool = *(ComponentPool*) lua_touserdata(L, lua_upvalueindex(1));
+    lua_pushinteger(L, pool.GetSize());
+    return 1;
+}
+
+int DestroyComponentPool(lua_State* L)
+{
+    auto& pool = *(ComponentPool*) luaL_checkudata(L, 1, ComponentPoolMetatableName);
+    LOG_TRACE("destroying pool of type [%.*s]", LOG_STRING_VIEW(pool.GetType().get_name()));
+    pool.~ComponentPool();
+    return 0;
+}
+
+int IndexComponentPoolColumn(lua_State* L)
+{
+    constexpr int viewIndex = 1;
+    constexpr int handleIndex = 2;
+    auto& view = *(ComponentPoolColumnView*) luaL_checkudata(L, viewIndex, ComponentPoolColumnMetatableName);
+    ComponentPool::Handle handle = GetComponentPoolHandle(L, *view.pool, handleIndex);
+    view.converter->copyToLuaStack(L, view.pool->GetElement(*view.column, view.pool->GetDenseIndex(handle)));
+    int indexedValuesCount = 1;
+    return indexedValuesCount;
+}
+
+int NewIndexComponentPoolColumn(lua_State* L)
+{
+    constexpr int viewIndex = 1;
+    constexpr int handleIndex = 2;
+    constexpr int valueIndex = 3;
+    auto& view = *(ComponentPoolColumnView*) luaL_checkudata(L, viewIndex, ComponentPoolColumnMetatableName);
+    ComponentPool::Handle handle = GetComponentPoolHandle(L, *view.pool, handleIndex);
+    view.converter->copyFromLuaStack(L, valueIndex, view.pool->GetElement(*view.column, view.pool->GetDenseIndex(handle)));
+    return 0;
+}
+
+// Binds a pool for the type to the global [<type>Pool], e.g. SpritePool. Scripts create instances with SpritePool.create(),
+// which returns an integer handle, and read/write properties through typed column views, e.g. SpritePool.x[handle] = 10.
+// Column views are indexed by handle only, they have no length since handles are not 1..n.
+void CreateComponentPool(lua_State* L, const rttr::type& type)
+{
+    const std::string& typeName = type.get_name().to_string();
+    const std::string& poolName = GetComponentPoolName(type);
+
+    void* userdata = lua_newuserdata(L, sizeof(ComponentPool));
+    auto* pool = new(userdata) ComponentPool(type);
+    int poolIndex = lua_gettop(L);
+    if (luaL_newmetatable(L, ComponentPoolMetatableName))
+    {
+        lua_pushcfunction(L, DestroyComponentPool);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, poolIndex);
+    lua_pushvalue(L, poolIndex);
+    lua_setfield(L, LUA_REGISTRYINDEX, poolName.c_str());
+    LOG_DEBUG("created pool [%s] with [%d] columns", poolName.c_str(), (int) pool->GetColumns().size());
+
+    const std::string& globalName = typeName + "Pool";
+    lua_newtable(L);
+    int globalIndex = lua_gettop(L);
+    lua_pushvalue(L, globalIndex);
+    lua_setglobal(L, globalName.c_str());
+
+    const luaL_Reg poolFunctions[] = {
+            {"create", CreateComponentPoolInstance},
+            {"destroy", DestroyComponentPoolInstance},
+            {"valid", IsValidComponentPoolInstance},
+            {"size", GetComponentPoolSize},
+            {nullptr, nullptr}
+    };
+    lua_pushvalue(L, poolIndex);
+    constexpr int poolUpvalueCount = 1;
+    luaL_setfuncs(L, poolFunctions, poolUpvalueCount);
+    LOG_DEBUG("created global [%s]", globalName.c_str());
+
+    if (luaL_newmetatable(L, ComponentPoolColumnMetatableName))
+    {
+        lua_pushcfunction(L, IndexComponentPoolColumn);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, NewIndexComponentPoolColumn);
+        lua_setfield(L, -2, "__newindex");
+    }
+    lua_pop(L, 1);
+
+    for (ComponentPool::Column& column : pool->GetColumns())
+    {
+        const std::string& columnName = column.property.get_name().to_string();
+        const LuaTypeConverter* converter = FindLuaTypeConverter(column.type);
+        if (converter == nullptr || converter->copyToLuaStack == nullptr)
+        {
+            LOG_WARN("skipping column [%s] of unsupported type [%.*s] in pool [%s]", columnName.c_str(), LOG_STRING_VIEW(column.type.get_name()), poolName.c_str());
+            continue;
+        }
+        void* viewUserdata = lua_newuserdata(L, sizeof(ComponentPoolColumnView));
+        new(viewUserdata) ComponentPoolColumnView{pool, &column, converter};
+        luaL_setmetatable(L, ComponentPoolColumnMetatableName);
+        lua_pushvalue(L, poolIndex);
+        lua_setuservalue(L, -2);
+        lua_setfield(L, globalIndex, columnName.c_str());
+        LOG_DEBUG("added column view [%s] to global [%s]", columnName.c_str(), globalName.c_str());
+    }
+
+    constexpr int poolAndGlobalCount = 2;
+    lua_pop(L, poolAndGlobalCount);
+}
+
+// Invokes a native method that returns a LuaAwait, which leaves the operation id on the lua stack, and suspends the
+// calling lua task until the operation completes. Upvalues are the method and a closure that invokes it.
+// The caller is checked first, so an operation is never started when it could not be awaited. The method is invoked in
+// protected mode, so the await prepared for it also ends when it raises a lua error.
+int InvokeAwaitingMethod(lua_State* L)
+{
+    if (!LuaTaskRunner::PrepareAwait(L))
+    {
+        const auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
+        const std::string& methodName = method.get_name().to_string();
+        return luaL_error(L, "can only call awaiting method [%s] from a lua task\n", methodName.c_str());
+    }
+    int argumentCount = lua_gettop(L);
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_insert(L, 1);
+    constexpr int resultCount = 1;
+    constexpr int messageHandlerIndex = 0;
+    int status = lua_pcall(L, argumentCount, resultCount, messageHandlerIndex);
+    if (status != LUA_OK)
+    {
+        LuaTaskRunner::CancelAwait();
+        return lua_error(L);
+    }
+    auto operationId = (LuaTaskRunner::OperationId) lua_tointeger(L, -1);
+    return LuaTaskRunner::Await(L, operationId);
+}
+
+// Calls the thunk of a method, timing it for the profiler and the method stats of the lua state when either is attached.
+// Thunks read their arguments as part of the call, so their marshalling counts towards the body (and native time).
+// Upvalues are the method and the thunk.
+int InvokeThunk(lua_State* L)
+{
+    lua_CFunction thunk = lua_tocfunction(L, lua_upvalueindex(2));
+    LuaProfiler* profiler = LuaProfiler::Find(L);
+    LuaMethodStats* methodStats = LuaMethodStats::Find(L);
+    if (profiler == nullptr && methodStats == nullptr)
+    {
+        return thunk(L);
+    }
+    const auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
+    uint64_t startTime = LuaProfiler::GetTime();
+    int returnValueCount = thunk(L);
+    if (profiler != nullptr)
+    {
+        AddProfilerNativeCall(*profiler, L, method, startTime);
+    }
+    if (methodStats != nullptr)
+    {
+        AddMethodStatsCall(*methodStats, method, startTime, startTime, LuaProfiler::GetTime());
+    }
+    return returnValueCount;
+}
+
+void PushMethodClosure(lua_State* L, const rttr::method& method, lua_CFunction invokeMethodFunction)
+{
+    const rttr::variant& thunk = method.get_metadata(LuaMetadata::Thunk);
+    if (method.get_return_type() == rttr::type::get<LuaAwait>())
+    {
+        LOG_DEBUG("binding method [%.*s] as awaiting method", LOG_STRING_VIEW(method.get_name()));
+        lua_pushlightuserdata(L, (void*) &method);
+        lua_pushlightuserdata(L, (void*) &method);
+        constexpr int invokeUpvalueCount = 1;
+        lua_pushcclosure(L, thunk.is_valid() ? thunk.get_value<lua_CFunction>() : invokeMethodFunction, invokeUpvalueCount);
+        constexpr int upvalueCount = 2;
+        lua_pushcclosure(L, InvokeAwaitingMethod, upvalueCount);
+        return;
+    }
+    if (thunk.is_valid())
+    {
+        LOG_DEBUG("binding method [%.*s] through its lua thunk", LOG_STRING_VIEW(method.get_name()));
+        lua_pushlightuserdata(L, (void*) &method);
+        lua_pushcfunction(L, thunk.get_value<lua_CFunction>());
+        constexpr int upvalueCount = 2;
+        lua_pushcclosure(L, InvokeThunk, upvalueCount);
+        return;
+    }
+    lua_pushlightuserdata(L, (void*) &method);
+    constexpr int upvalueCount = 1;
+    lua_pushcclosure(L, invokeMethodFunction, upvalueCount);
+}
+
+int PanicLua(lua_State* L)
+{
+    const char* message = lua_tostring(L, -1);
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", message != nullptr ? message : "error object is not a string");
+    return 0;
+}
+
+LuaMemoryBudget* GetLuaMemoryBudget(lua_State* L)
+{
+    void* budget;
+    lua_getallocf(L, &budget);
+    return static_cast<LuaMemoryBudget*>(budget);
+}
+
+LuaPoolAllocator* GetLuaPoolAllocator(lua_State* L)
+{
+    return static_cast<LuaPoolAllocator*>(GetLuaMemoryBudget(L)->GetAllocatorUserdata());
+}
+
+int GetLuaMemoryStats(lua_State* L)
+{
+    const LuaMemoryBudget* budget = GetLuaMemoryBudget(L);
+    constexpr int arrayElementCount = 0;
+    constexpr int fieldCount = 6;
+    lua_createtable(L, arrayElementCount, fieldCount);
+    lua_pushinteger(L, (lua_Integer) budget->GetLiveBytes());
+    lua_setfield(L, -2, "liveBytes");
+    lua_pushinteger(L, (lua_Integer) budget->GetPeakBytes());
+    lua_setfield(L, -2, "peakBytes");
+    lua_pushinteger(L, (lua_Integer) budget->GetLimit());
+    lua_setfield(L, -2, "limit");
+    lua_pushinteger(L, (lua_Integer) budget->GetAllocationCount());
+    lua_setfield(L, -2, "allocationCount");
+    lua_pushinteger(L, (lua_Integer) budget->GetLiveAllocationCount());
+    lua_setfield(L, -2, "liveAllocationCount");
+    lua_pushinteger(L, (lua_Integer) budget->GetFailedAllocationCount());
+    lua_setfield(L, -2, "failedAllocationCount");
+    return 1;
+}
+
+// Returns an empty table while the method stats of the lua state are not recorded
+int GetLuaMethodStats(lua_State* L)
+{
+    const LuaMethodStats* methodStats = LuaMethodStats::Find(L);
+    if (methodStats == nullptr)
+    {
+        lua_newtable(L);
+        return 1;
+    }
+    methodStats->PutOnLuaStack(L);
+    return 1;
+}
+
+lua_State* CreateLuaState(size_t memoryLimit, size_t maxAllocatorBytes)
+{
+    auto* allocator = new LuaPoolAllocator(maxAllocatorBytes);
+    auto* budget = new LuaMemoryBudget(LuaPoolAllocator::Allocate, allocator, memoryLimit);
+    lua_State* L = lua_newstate(LuaMemoryBudget::Allocate, budget);
+    if (L == nullptr)
+    {
+        delete budget;
+        delete allocator;
+        return nullptr;
+    }
+    lua_atpanic(L, PanicLua);
+
+    lua_newtable(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &BorrowedUserdataCacheKey);
+    LOG_DEBUG("created table of borrowed userdata caches");
+
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setglobal(L, "Global");
+    for (const auto& method : rttr::type::get_global_methods())
+    {
+        lua_pushstring(L, method.get_name().to_string().c_str());
+        PushMethodClosure(L, method, InvokeGlobalMethod);
+        lua_settable(L, -3);
+    }
+    lua_pushcfunction(L, GetLuaMemoryStats);
+    lua_setfield(L, -2, "MemoryStats");
+    lua_pushcfunction(L, GetLuaMethodStats);
+    lua_setfield(L, -2, "Stats");
+    lua_pop(L, 1);
+
+    for (const auto& type : rttr::type::get_types())
+    {
+        const std::string& typeName = type.get_name().to_string();
+        if (type.is_class())
+        {
+            LOG_DEBUG("binding class type [%s] to lua", typeName.c_str());
+
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_setglobal(L, typeName.c_str());
+            LOG_DEBUG("created global [%s]", typeName.c_str());
+
+            const std::string& metatableName = GetMetatableName(type);
+            luaL_newmetatable(L, metatableName.c_str());
+            lua_pushboolean(L, true);
+            lua_rawsetp(L, -2, &BoundUserdataMarkerKey);
+            LOG_DEBUG("created metatable [%s]", metatableName.c_str());
+
+            const rttr::variant& inlineStorage = type.get_metadata(LuaMetadata::InlineStorage);
+            lua_pushlightuserdata(L, (void*) &type);
+            lua_pushvalue(L, -2);
+            int newUpvalueCount = 2;
+            if (inlineStorage.is_valid())
+            {
+                lua_pushlightuserdata(L, (void*) inlineStorage.get_value<const LuaInlineStorage*>());
+                newUpvalueCount++;
+            }
+            lua_pushcclosure(L, CreateUserdata, newUpvalueCount);
+            lua_setfield(L, -3, "new");
+            LOG_DEBUG("added new/create function with [%d] upvalues [%s, %s]", newUpvalueCount, typeName.c_str(), metatableName.c_str());
+
+            lua_pushstring(L, "__gc");
+            if (inlineStorage.is_valid())
+            {
+                lua_pushlightuserdata(L, (void*) inlineStorage.get_value<const LuaInlineStorage*>());
+                constexpr int gcUpvalueCount = 1;
+                lua_pushcclosure(L, DestroyUserdata, gcUpvalueCount);
+            }
+            else
+            {
+                lua_pushcfunction(L, DestroyUserdata);
+            }
+            lua_settable(L, -3);
+            LOG_DEBUG("added garbage collect function to metatable [%s]", metatableName.c_str());
+
+            lua_newtable(L);
+            for (const auto& method : type.get_methods())
+            {
+                PushMethodClosure(L, method, InvokeMethodOnUserdata);
+                lua_setfield(L, -2, method.get_name().to_string().c_str());
+            }
+            lua_setfield(L, -2, "__methods");
+            LOG_DEBUG("added method closure table to metatable [%s]", metatableName.c_str());
+
+            for (const auto& method : type.get_methods())
+            {
+                lua_pushlightuserdata(L, (void*) &method);
+                constexpr int batchUpvalueCount = 1;
+                lua_pushcclosure(L, InvokeMethodOnUserdataBatch, batchUpvalueCount);
+                const std::string& batchName = method.get_name().to_string() + "_batch";
+                lua_setfield(L, -3, batchName.c_str());
+            }
+            LOG_DEBUG("added batch functions to global [%s]", typeName.c_str());
+
+            lua_newtable(L);
+            lua_newtable(L);
+            for (const auto& property : type.get_properties())
+            {
+                const rttr::variant& field = property.get_metadata(LuaMetadata::Field);
+                if (field.is_valid())
+                {
+                    lua_pushlightuserdata(L, (void*) field.get_value<const LuaField*>());
+                    lua_setfield(L, -3, property.get_name().to_string().c_str());
+                }
+                else
+                {
+                    lua_pushlightuserdata(L, (void*) &property);
+                    lua_setfield(L, -2, property.get_name().to_string().c_str());
+                }
+            }
+            lua_setfield(L, -3, "__properties");
+            lua_setfield(L, -2, "__fields");
+            LOG_DEBUG("added field and property lookup tables to metatable [%s]", metatableName.c_str());
+
+            lua_pushstring(L, "__index");
+            lua_pushstring(L, typeName.c_str());
+            lua_getfield(L, -3, "__methods");
+            lua_getfield(L, -4, "__fields");
+            lua_getfield(L, -5, "__properties");
+            constexpr int indexUpvalueCount = 4;
+            lua_pushcclosure(L, IndexUserdata, indexUpvalueCount);
+            lua_settable(L, -3);
+            LOG_DEBUG("added index function with upvalues [%s, __methods, __fields, __properties] to metatable [%s]", typeName.c_str(), metatableName.c_str());
+
+            lua_pushstring(L, "__newindex");
+            lua_pushstring(L, typeName.c_str());
+            lua_getfield(L, -3, "__fields");
+            lua_getfield(L, -4, "__properties");
+            constexpr int newindexUpvalueCount = 3;
+            lua_pushcclosure(L, NewIndexOnUserdata, newindexUpvalueCount);
+            lua_settable(L, -3);
+            LOG_DEBUG("added newindex function with upvalues [%s, __fields, __properties] to metatable [%s]", typeName.c_str(), metatableName.c_str());
+
+            constexpr int classTableAndMetatableCount = 2;
+            lua_pop(L, classTableAndMetatableCount);
+
+            if (type.get_metadata(LuaMetadata::Pool).is_valid())
+            {
+                CreateComponentPool(L, type);
+            }
+        }
+    }
+
+    return L;
+}
+
+void DestroyLuaState(lua_State* L)
+{
+    LuaMemoryBudget* budget = GetLuaMemoryBudget(L);
+    LuaPoolAllocator* allocator = GetLuaPoolAllocator(L);
+    lua_close(L);
+    LOG_DEBUG("lua state used [%d] bytes at peak in [%d] allocations, [%d] allocations failed", (int) budget->GetPeakBytes(), (int) budget->GetAllocationCount(), (int) budget->GetFailedAllocationCount());
+    for (size_t i = 0; i < LuaPoolAllocator::SizeClassCount; i++)
+    {
+        LuaPoolAllocator::SizeClassStats stats = allocator->GetSizeClassStats(i);
+        if (stats.allocationCount > 0)
+        {
+            LOG_DEBUG("lua allocations of [%d] bytes: [%d] total, [%d] peak live, [%d] blocks reserved", (int) stats.blockSize, (int) stats.allocationCount, (int) stats.peakLiveBlockCount, (int) stats.reservedBlockCount);
+        }
+    }
+    LOG_DEBUG("lua allocations above [%d] bytes: [%d] total", (int) LuaPoolAllocator::MaxBlockSize, (int) allocator->GetLargeAllocationCount());
+    delete budget;
+    delete allocator;
+}
+
+void LoadLuaScript(lua_State* L, const char* script)
+{
+    if (luaL_loadstring(L, script) != LUA_OK)
+    {
+        luaL_error(L, "could not load lua script: %s", lua_tostring(L, -1));
+    }
+}
+
+void LoadLuaScript(lua_State* L, const char* script, const std::string& cacheDirectory)
+{
+    if (LoadCachedLuaChunk(L, script, strlen(script), script, cacheDirectory) != LUA_OK)
+    {
+        luaL_error(L, "could not load lua script: %s", lua_tostring(L, -1));
+    }
+}
+
+void LoadLuaScriptFile(lua_State* L, const char* path)
+{
+    if (LoadLuaFile(L, path) != LUA_OK)
+    {
+        luaL_error(L, "could not load lua script file: %s", lua_tostring(L, -1));
+    }
+}
+
+void RunLuaScriptDirectory(lua_State* L, const char* directory)
+{
+    int status = RunLuaDirectory(L, directory);
+    LuaFunctionRef::InvalidateAll(L);
+    if (status != LUA_OK)
+    {
+        luaL_error(L, "could not run lua script directory: %s", lua_tostring(L, -1));
+    }
+}
+
+void RunLua(lua_State* L)
+{
+    constexpr int argumentCount = 0;
+    constexpr int resultCount = LUA_MULTRET;
+    constexpr int messageHandlerIndex = 0;
+    int status = lua_pcall(L, argumentCount, resultCount, messageHandlerIndex);
+    LuaFunctionRef::InvalidateAll(L);
+    if (status != LUA_OK)
+    {
+        luaL_error(L, "could not run lua with loaded script: %s", lua_tostring(L, -1));
+    }
+}
@@ -0,0 +1,597 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <rttr/registration>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "component_pool.h"
+#include "log.h"
+#include "lua_allocator.h"
+#include "lua_function_ref.h"
+#include "lua_memory_budget.h"
+#include "lua_scheduler.h"
+
+int PutOnLuaStack(lua_State* L, const rttr::variant& variant);
+
+enum class LuaMetadata
+{
+    Thunk,
+    Pool,
+    InlineStorage,
+    Field
+};
+
+template<typename T>
+T GetThunkArgument(lua_State* L, int luaIndex)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        return lua_toboolean(L, luaIndex);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        return (T) luaL_checkinteger(L, luaIndex);
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        return (T) luaL_checknumber(L, luaIndex);
+    }
+    else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>)
+    {
+        size_t length = 0;
+        const char* value = luaL_checklstring(L, luaIndex, &length);
+        return T(value, length);
+    }
+    else
+    {
+        static_assert(std::is_same_v<T, const char*>, "unsupported argument type for lua thunk");
+        return luaL_checkstring(L, luaIndex);
+    }
+}
+
+template<typename T>
+int PutThunkResultOnLuaStack(lua_State* L, T&& result)
+{
+    using ResultType = std::decay_t<T>;
+    if constexpr (std::is_same_v<ResultType, bool>)
+    {
+        lua_pushboolean(L, result);
+    }
+    else if constexpr (std::is_integral_v<ResultType>)
+    {
+        lua_pushinteger(L, (lua_Integer) result);
+    }
+    else if constexpr (std::is_floating_point_v<ResultType>)
+    {
+        lua_pushnumber(L, (lua_Number) result);
+    }
+    else if constexpr (std::is_same_v<ResultType, const char*>)
+    {
+        lua_pushstring(L, result);
+    }
+    else if constexpr (std::is_same_v<ResultType, std::string_view> || std::is_same_v<ResultType, std::string>)
+    {
+        lua_pushlstring(L, result.data(), result.size());
+    }
+    else
+    {
+        return PutOnLuaStack(L, rttr::variant(std::forward<T>(result)));
+    }
+    constexpr int returnValueCount = 1;
+    return returnValueCount;
+}
+
+void CheckThunkArgumentCount(lua_State* L, int expectedLuaArgumentCount);
+
+template<typename Class>
+Class* GetNativeInstance(lua_State* L, const rttr::variant& variant)
+{
+    // Userdata created from lua and borrowed native objects hold a plain pointer, which needs no conversion
+    if (variant.get_type() == rttr::type::get<Class*>())
+    {
+        return variant.get_value<Class*>();
+    }
+    auto* instance = rttr::instance(variant).try_convert<Class>();
+    if (instance == nullptr)
+    {
+        const std::string& typeName = variant.get_type().get_name().to_string();
+        luaL_error(L, "could not convert userdata of type [%s] to native owner type\n", typeName.c_str());
+    }
+    return instance;
+}
+
+// Returns the rttr::variant at the start of a userdata created by the binding, or nullptr for any other lua value.
+rttr::variant* GetBoundUserdata(lua_State* L, int luaIndex);
+
+template<typename Class>
+Class* GetThunkInstance(lua_State* L)
+{
+    constexpr int userdataIndex = 1;
+    rttr::variant* variant = GetBoundUserdata(L, userdataIndex);
+    if (variant == nullptr)
+    {
+        luaL_error(L, "expected bound userdata on lua index [%d] when invoking method\n", userdataIndex);
+    }
+    return GetNativeInstance<Class>(L, *variant);
+}
+
+template<typename Method>
+struct LuaThunkTraits;
+
+template<typename Result, typename... Arguments>
+struct LuaThunkTraits<Result (*)(Arguments...)>
+{
+    static constexpr std::size_t ArgumentCount = sizeof...(Arguments);
+
+    template<auto Method, std::size_t... I>
+    static int Invoke(lua_State* L, std::index_sequence<I...>)
+    {
+        CheckThunkArgumentCount(L, ArgumentCount);
+        if constexpr (std::is_void_v<Result>)
+        {
+            Method(GetThunkArgument<std::decay_t<Arguments>>(L, I + 1)...);
+            return 0;
+        }
+        else
+        {
+            return PutThunkResultOnLuaStack(L, Method(GetThunkArgument<std::decay_t<Arguments>>(L, I + 1)...));
+        }
+    }
+};
+
+template<typename Result, typename Class, typename... Arguments>
+struct LuaThunkTraits<Result (Class::*)(Arguments...)>
+{
+    static constexpr std::size_t ArgumentCount = sizeof...(Arguments);
+
+    template<auto Method, std::size_t... I>
+    static int Invoke(lua_State* L, std::index_sequence<I...>)
+    {
+        constexpr int userdataCount = 1;
+        CheckThunkArgumentCount(L, userdataCount + ArgumentCount);
+        Class* instance = GetThunkInstance<Class>(L);
+        if constexpr (std::is_void_v<Result>)
+        {
+            (instance->*Method)(GetThunkArgument<std::decay_t<Arguments>>(L, I + 2)...);
+            return 0;
+        }
+        else
+        {
+            return PutThunkResultOnLuaStack(L, (instance->*Method)(GetThunkArgument<std::decay_t<Arguments>>(L, I + 2)...));
+        }
+    }
+};
+
+template<typename Result, typename Class, typename... Arguments>
+struct LuaThunkTraits<Result (Class::*)(Arguments...) const> : LuaThunkTraits<Result (Class::*)(Arguments...)>
+{
+};
+
+// Calls the native method straight from the lua stack, without boxing arguments and results into rttr::argument/rttr::variant.
+template<auto Method>
+int LuaThunk(lua_State* L)
+{
+    using Traits = LuaThunkTraits<decltype(Method)>;
+    return Traits::template Invoke<Method>(L, std::make_index_sequence<Traits::ArgumentCount>());
+}
+
+// Opt-in metadata for a registered method, picked up by CreateLuaState to bind the method through a LuaThunk
+// instead of the generic rttr invoke path, e.g. .method("Move", &Sprite::Move)(LuaThunkMetadata<&Sprite::Move>())
+template<auto Method>
+rttr::detail::metadata LuaThunkMetadata()
+{
+    return rttr::metadata(LuaMetadata::Thunk, (lua_CFunction) &LuaThunk<Method>);
+}
+
+// Reads/writes a plain data member of the instance in a userdata straight from/to the lua stack, without going through
+// rttr::property and rttr::variant.
+struct LuaField
+{
+    int (* putOnLuaStack)(lua_State* L, const rttr::variant& instance);
+    void (* getFromLuaStack)(lua_State* L, int luaIndex, const rttr::variant& instance);
+};
+
+template<typename Member>
+struct LuaFieldTraits;
+
+template<typename Class, typename Field>
+struct LuaFieldTraits<Field Class::*>
+{
+    using ClassType = Class;
+    using FieldType = Field;
+};
+
+template<auto Member>
+const LuaField* GetLuaField()
+{
+    using Traits = LuaFieldTraits<decltype(Member)>;
+    using Class = typename Traits::ClassType;
+    using Field = typename Traits::FieldType;
+    // Pointers and views (e.g. const char*, std::string_view) set from lua would refer to memory owned by lua
+    static_assert(std::is_arithmetic_v<Field> || std::is_same_v<Field, std::string>, "only arithmetic and std::string fields can be read/written directly");
+    static const LuaField field = {
+            [](lua_State* L, const rttr::variant& instance)
+            {
+                return PutThunkResultOnLuaStack(L, GetNativeInstance<Class>(L, instance)->*Member);
+            },
+            [](lua_State* L, int luaIndex, const rttr::variant& instance)
+            {
+                GetNativeInstance<Class>(L, instance)->*Member = GetThunkArgument<Field>(L, luaIndex);
+            }
+    };
+    return &field;
+}
+
+// Opt-in metadata for a property bound to a data member, picked up by CreateLuaState to read/write the member directly,
+// e.g. .property("x", &Sprite::x)(LuaFieldMetadata<&Sprite::x>())
+template<auto Member>
+rttr::detail::metadata LuaFieldMetadata()
+{
+    return rttr::metadata(LuaMetadata::Field, GetLuaField<Member>());
+}
+
+// Lua only guarantees this alignment for the memory of a userdata.
+union LuaUserdataAlignment
+{
+    LUAI_MAXALIGN;
+};
+
+// Constructs, destroys and references an object of a registered class in place, so CreateUserdata can store the object
+// inside the userdata itself instead of behind a separate heap allocation.
+struct LuaInlineStorage
+{
+    size_t alignment;
+    void (* construct)(void* object);
+    void (* destroy)(void* object);
+    rttr::variant (* createReference)(void* object);
+};
+
+template<typename T>
+const LuaInlineStorage* GetLuaInlineStorage()
+{
+    static_assert(alignof(T) <= alignof(LuaUserdataAlignment), "type is over-aligned for inline storage in lua userdata");
+    static const LuaInlineStorage inlineStorage = {
+            alignof(T),
+            [](void* object) { new(object) T(); },
+            [](void* object) { ((T*) object)->~T(); },
+            [](void* object) { return rttr::variant((T*) object); }
+    };
+    return &inlineStorage;
+}
+
+// Opt-in metadata for a registered class, picked up by CreateLuaState to construct instances created from lua
+// (e.g. Sprite.new()) inside their userdata, e.g. rttr::registration::class_<Sprite>("Sprite")(LuaInlineStorageMetadata<Sprite>())
+template<typename T>
+rttr::detail::metadata LuaInlineStorageMetadata()
+{
+    return rttr::metadata(LuaMetadata::InlineStorage, GetLuaInlineStorage<T>());
+}
+
+int CreateUserdata(lua_State* L, const rttr::variant& variant);
+
+int PutMethodArgumentsOnLuaStack(lua_State* L);
+
+// Address of this key is the registry key of the table of borrowed userdata caches, one per native type.
+inline constexpr char BorrowedUserdataCacheKey = 0;
+
+// Address of this key is the key of the borrowed userdata cache of the type (weak values, keyed by native pointer)
+// in the table of borrowed userdata caches. The same address can be shared by different types, e.g. an object and
+// its first member, so every type gets its own cache.
+template<typename T>
+inline constexpr char BorrowedUserdataTypeKey = 0;
+
+// Pushes a userdata that refers to, but does not own, a native object. The userdata is cached per object and type,
+// so pushing the same object again (e.g. every frame) reuses it instead of allocating a new one. A borrow does not
+// tell whether the object at an address is still the same one, so the uservalue (i.e. the table of dynamic fields
+// set from lua) is cleared on reuse, just like it starts out empty for a new userdata.
+template<typename T>
+int PutBorrowedUserdataOnLuaStack(lua_State* L, T* object)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &BorrowedUserdataCacheKey);
+    if (lua_rawgetp(L, -1, &BorrowedUserdataTypeKey<T>) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_pushstring(L, "v");
+        lua_setfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, -3, &BorrowedUserdataTypeKey<T>);
+        LOG_DEBUG("created borrowed userdata cache for native type [%.*s]", LOG_STRING_VIEW(rttr::type::get<T>().get_name()));
+    }
+    lua_remove(L, -2);
+    int cacheIndex = lua_gettop(L);
+    if (lua_rawgetp(L, cacheIndex, object) == LUA_TUSERDATA)
+    {
+        LOG_TRACE("reusing borrowed userdata for native object of type [%.*s]", LOG_STRING_VIEW(rttr::type::get<T>().get_name()));
+        lua_pushnil(L);
+        lua_setuservalue(L, -2);
+        lua_remove(L, cacheIndex);
+        constexpr int borrowedCount = 1;
+        return borrowedCount;
+    }
+    lua_pop(L, 1);
+
+    rttr::variant variant(object);
+    int createdCount = CreateUserdata(L, variant);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, cacheIndex, object);
+    lua_remove(L, cacheIndex);
+    return createdCount;
+}
+
+// Objects of classes are borrowed, strings and everything else are put on the lua stack by value.
+template<typename T>
+int PutMethodArgumentsOnLuaStack(lua_State* L, T& argument)
+{
+    using ArgumentType = std::remove_cv_t<T>;
+    if constexpr (std::is_class_v<ArgumentType> && !std::is_same_v<ArgumentType, std::string> && !std::is_same_v<ArgumentType, std::string_view>)
+    {
+        return PutBorrowedUserdataOnLuaStack(L, &argument);
+    }
+    else
+    {
+        return PutThunkResultOnLuaStack(L, argument);
+    }
+}
+
+template<typename T, typename... E>
+int PutMethodArgumentsOnLuaStack(lua_State* L, T& argument, E& ... arguments)
+{
+    return PutMethodArgumentsOnLuaStack(L, argument) + PutMethodArgumentsOnLuaStack(L, arguments...);
+}
+
+void CallLuaMethodOnLuaStack(lua_State* L, const char* methodName, int argumentCount, int resultsCount);
+
+// Whether a result of a lua method can be read as T by GetLuaResult.
+template<typename T>
+bool IsLuaResult(lua_State* L, int luaIndex)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        return true;
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        int isInteger = 0;
+        lua_tointegerx(L, luaIndex, &isInteger);
+        return isInteger;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        int isNumber = 0;
+        lua_tonumberx(L, luaIndex, &isNumber);
+        return isNumber;
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        return lua_type(L, luaIndex) == LUA_TSTRING;
+    }
+    else
+    {
+        static_assert(std::is_pointer_v<T> && std::is_class_v<std::remove_pointer_t<T>>, "unsupported result type for lua method");
+        if (lua_isnil(L, luaIndex))
+        {
+            return true;
+        }
+        const rttr::variant* variant = GetBoundUserdata(L, luaIndex);
+        return variant != nullptr && (variant->get_type() == rttr::type::get<T>() || rttr::instance(*variant).try_convert<std::remove_pointer_t<T>>() != nullptr);
+    }
+}
+
+// Reads a result of a lua method straight off the lua stack, once it is known to be convertible (see IsLuaResult), so
+// it never raises a lua error. Class pointers point into the userdata (or at the borrowed native object), so objects
+// created from lua stay valid only for as long as lua keeps a reference to them.
+template<typename T>
+T GetLuaResult(lua_State* L, int luaIndex)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        return lua_toboolean(L, luaIndex);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        return (T) lua_tointeger(L, luaIndex);
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        return (T) lua_tonumber(L, luaIndex);
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        // Strings are copied, a view would dangle as soon as the results are popped
+        size_t length = 0;
+        const char* value = lua_tolstring(L, luaIndex, &length);
+        return T(value, length);
+    }
+    else
+    {
+        if (lua_isnil(L, luaIndex))
+        {
+            return nullptr;
+        }
+        const rttr::variant& variant = *GetBoundUserdata(L, luaIndex);
+        if (variant.get_type() == rttr::type::get<T>())
+        {
+            return variant.get_value<T>();
+        }
+        return rttr::instance(variant).try_convert<std::remove_pointer_t<T>>();
+    }
+}
+
+template<typename R>
+struct LuaResultTraits
+{
+    static constexpr int ResultsCount = 1;
+
+    // Position (from 0) of the first result that can not be read, or ResultsCount if all of them can.
+    static int FindInvalidResult(lua_State* L, int firstLuaIndex)
+    {
+        return IsLuaResult<R>(L, firstLuaIndex) ? ResultsCount : 0;
+    }
+
+    static R Get(lua_State* L, int firstLuaIndex)
+    {
+        return GetLuaResult<R>(L, firstLuaIndex);
+    }
+};
+
+template<>
+struct LuaResultTraits<void>
+{
+    static constexpr int ResultsCount = 0;
+};
+
+template<typename... R>
+struct LuaResultTraits<std::tuple<R...>>
+{
+    static constexpr int ResultsCount = sizeof...(R);
+
+    static int FindInvalidResult(lua_State* L, int firstLuaIndex)
+    {
+        int validResultsCount = 0;
+        (void) ((IsLuaResult<R>(L, firstLuaIndex + validResultsCount) && ++validResultsCount) && ...);
+        return validResultsCount;
+    }
+
+    static std::tuple<R...> Get(lua_State* L, int firstLuaIndex)
+    {
+        return Get(L, firstLuaIndex, std::index_sequence_for<R...>());
+    }
+
+    template<std::size_t... I>
+    static std::tuple<R...> Get(lua_State* L, int firstLuaIndex, std::index_sequence<I...>)
+    {
+        return std::tuple<R...>(GetLuaResult<R>(L, firstLuaIndex + (int) I)...);
+    }
+};
+
+// Calls the method on top of the lua stack (below its arguments) and converts its results to R, which is void,
+// a single value or a std::tuple of values. Lua pads missing results with nil and drops extra ones.
+// The results are checked before any of them is converted, so a lua error never skips the destructor of a result.
+template<typename R>
+R CallLuaMethodOnLuaStack(lua_State* L, const char* methodName, int argumentCount)
+{
+    constexpr int resultsCount = LuaResultTraits<R>::ResultsCount;
+    CallLuaMethodOnLuaStack(L, methodName, argumentCount, resultsCount);
+    if constexpr (resultsCount == 0)
+    {
+        return;
+    }
+    else
+    {
+        int firstResultIndex = lua_gettop(L) - resultsCount + 1;
+        int invalidResultPosition = LuaResultTraits<R>::FindInvalidResult(L, firstResultIndex);
+        if (invalidResultPosition != resultsCount)
+        {
+            luaL_error(L, "unexpected result [%d] of lua type [%s] from method [%s]\n", invalidResultPosition + 1,
+                       luaL_typename(L, firstResultIndex + invalidResultPosition), methodName);
+        }
+        R results = LuaResultTraits<R>::Get(L, firstResultIndex);
+        lua_pop(L, resultsCount);
+        return results;
+    }
+}
+
+template<typename R = void, typename... T>
+R CallLuaMethod(lua_State* L, const char* methodName, T& ... arguments)
+{
+    lua_getglobal(L, methodName);
+    int methodIndex = -1;
+    if (lua_type(L, methodIndex) != LUA_TFUNCTION)
+    {
+        luaL_error(L, "expected method [%s] on lua stack index [%d]", methodName, methodIndex);
+    }
+    int argumentCount = PutMethodArgumentsOnLuaStack(L, arguments...);
+    return CallLuaMethodOnLuaStack<R>(L, methodName, argumentCount);
+}
+
+template<typename R = void, typename... T>
+R CallLuaMethod(LuaFunctionRef& method, T& ... arguments)
+{
+    lua_State* L = method.GetLuaState();
+    method.PutOnLuaStack();
+    int argumentCount = PutMethodArgumentsOnLuaStack(L, arguments...);
+    return CallLuaMethodOnLuaStack<R>(L, method.GetFunctionName().c_str(), argumentCount);
+}
+
+// Like CallLuaMethod, but for native code that is not called from lua (e.g. jobs of a LuaScheduler): failures are
+// thrown as std::runtime_error instead of being raised as lua errors, which would longjmp across the C++ frames of the
+// caller. Only running out of lua memory while putting the arguments on the lua stack is still a lua error.
+template<typename R = void, typename... T>
+R CallLuaMethodFromNative(lua_State* L, const char* methodName, T& ... arguments)
+{
+    constexpr int resultsCount = LuaResultTraits<R>::ResultsCount;
+    int top = lua_gettop(L);
+    if (lua_getglobal(L, methodName) != LUA_TFUNCTION)
+    {
+        lua_settop(L, top);
+        throw std::runtime_error(std::string("expected method [") + methodName + "] on lua stack");
+    }
+    int argumentCount = PutMethodArgumentsOnLuaStack(L, arguments...);
+    constexpr int messageHandlerIndex = 0;
+    if (lua_pcall(L, argumentCount, resultsCount, messageHandlerIndex) != LUA_OK)
+    {
+        const char* message = lua_tostring(L, -1);
+        std::string error = std::string("could not call method [") + methodName + "]: " + (message != nullptr ? message : "error object is not a string");
+        lua_settop(L, top);
+        throw std::runtime_error(error);
+    }
+    if constexpr (resultsCount == 0)
+    {
+        return;
+    }
+    else
+    {
+        int firstResultIndex = top + 1;
+        int invalidResultPosition = LuaResultTraits<R>::FindInvalidResult(L, firstResultIndex);
+        if (invalidResultPosition != resultsCount)
+        {
+            std::string error = std::string("unexpected result [") + std::to_string(invalidResultPosition + 1) + "] of lua type ["
+                                + luaL_typename(L, firstResultIndex + invalidResultPosition) + "] from method [" + methodName + "]";
+            lua_settop(L, top);
+            throw std::runtime_error(error);
+        }
+        R results = LuaResultTraits<R>::Get(L, firstResultIndex);
+        lua_settop(L, top);
+        return results;
+    }
+}
+
+// Copies the arguments into the job, the call runs later on one of the workers of the scheduler
+template<typename R = void, typename... T>
+std::future<R> CallLuaMethodAsync(LuaScheduler& scheduler, const char* methodName, const T& ... arguments)
+{
+    return scheduler.Submit([methodName, arguments...](lua_State* L) mutable
+    {
+        return CallLuaMethodFromNative<R>(L, methodName, arguments...);
+    });
+}
+
+ComponentPool* GetComponentPool(lua_State* L, const rttr::type& type);
+
+LuaMemoryBudget* GetLuaMemoryBudget(lua_State* L);
+
+LuaPoolAllocator* GetLuaPoolAllocator(lua_State* L);
+
+// Creates a lua state with a Global table of the registered global methods and a table per registered class.
+lua_State* CreateLuaState(size_t memoryLimit = LuaMemoryBudget::Unlimited, size_t maxAllocatorBytes = LuaPoolAllocator::Unlimited);
+
+void DestroyLuaState(lua_State* L);
+
+void LoadLuaScript(lua_State* L, const char* script);
+
+void LoadLuaScript(lua_State* L, const char* script, const std::string& cacheDirectory);
+
+void LoadLuaScriptFile(lua_State* L, const char* path);
+
+void RunLuaScriptDirectory(lua_State* L, const char* directory);
+
+void RunLua(lua_State* L);
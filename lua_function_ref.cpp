@@ -0,0 +1,103 @@
+#include "lua_function_ref.h"
+#include "log.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+namespace
+{
+    // Address of this key is the registry key of the userdata holding the references of a lua state
+    constexpr char FunctionRefsKey = 0;
+
+    using FunctionRefs = std::vector<LuaFunctionRef*>;
+
+    int DestroyFunctionRefs(lua_State* L)
+    {
+        auto* functionRefs = (FunctionRefs*) lua_touserdata(L, 1);
+        functionRefs->~FunctionRefs();
+        return 0;
+    }
+
+    FunctionRefs* GetFunctionRefs(lua_State* L)
+    {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &FunctionRefsKey) == LUA_TUSERDATA)
+        {
+            auto* functionRefs = (FunctionRefs*) lua_touserdata(L, -1);
+            lua_pop(L, 1);
+            return functionRefs;
+        }
+        lua_pop(L, 1);
+        auto* functionRefs = new(lua_newuserdata(L, sizeof(FunctionRefs))) FunctionRefs();
+        lua_newtable(L);
+        lua_pushcfunction(L, DestroyFunctionRefs);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &FunctionRefsKey);
+        return functionRefs;
+    }
+}
+
+LuaFunctionRef::LuaFunctionRef(lua_State* L, std::string functionName)
+        : L(L), functionName(std::move(functionName))
+{
+    GetFunctionRefs(L)->push_back(this);
+}
+
+LuaFunctionRef::~LuaFunctionRef()
+{
+    Invalidate();
+    FunctionRefs* functionRefs = GetFunctionRefs(L);
+    functionRefs->erase(std::remove(functionRefs->begin(), functionRefs->end(), this), functionRefs->end());
+}
+
+lua_State* LuaFunctionRef::GetLuaState() const
+{
+    return L;
+}
+
+const std::string& LuaFunctionRef::GetFunctionName() const
+{
+    return functionName;
+}
+
+void LuaFunctionRef::PutOnLuaStack()
+{
+    if (reference != LUA_NOREF)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, reference);
+        return;
+    }
+    if (lua_getglobal(L, functionName.c_str()) != LUA_TFUNCTION)
+    {
+        luaL_error(L, "expected global function [%s] but got [%s]\n", functionName.c_str(), luaL_typename(L, -1));
+    }
+    lua_pushvalue(L, -1);
+    reference = luaL_ref(L, LUA_REGISTRYINDEX);
+    LOG_TRACE("resolved reference to lua function [%s]", functionName.c_str());
+}
+
+void LuaFunctionRef::Invalidate()
+{
+    if (reference != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, reference);
+        reference = LUA_NOREF;
+    }
+}
+
+void LuaFunctionRef::InvalidateAll(lua_State* L)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &FunctionRefsKey) != LUA_TUSERDATA)
+    {
+        lua_pop(L, 1);
+        return;
+    }
+    auto* functionRefs = (FunctionRefs*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    for (LuaFunctionRef* functionRef : *functionRefs)
+    {
+        functionRef->Invalidate();
+    }
+    LOG_TRACE("invalidated [%d] lua function references", (int) functionRefs->size());
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <string>
+
+// Refers to a global lua function through the lua registry, so that calling it repeatedly (e.g. every frame) skips
+// looking it up by name. The function is looked up on first use, and again after the references of the lua state have
+// been invalidated because scripts were (re)loaded and may have redefined it. References have to be destroyed before
+// their lua state is closed.
+class LuaFunctionRef
+{
+private:
+    lua_State* L;
+    std::string functionName;
+    int reference = LUA_NOREF;
+
+public:
+    LuaFunctionRef(lua_State* L, std::string functionName);
+
+    ~LuaFunctionRef();
+
+    LuaFunctionRef(const LuaFunctionRef&) = delete;
+
+    LuaFunctionRef& operator=(const LuaFunctionRef&) = delete;
+
+    lua_State* GetLuaState() const;
+
+    const std::string& GetFunctionName() const;
+
+    // Pushes the function, or raises a lua error when there is no global function with the name.
+    void PutOnLuaStack();
+
+    // Makes the reference look the function up by name again on its next use.
+    void Invalidate();
+
+    // Invalidates all references of the lua state, to be called after loading scripts.
+    static void InvalidateAll(lua_State* L);
+};
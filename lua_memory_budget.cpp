@@ -0,0 +1,97 @@
+#include "lua_memory_budget.h"
+
+LuaMemoryBudget::LuaMemoryBudget(lua_Alloc allocate, void* allocatorUserdata, size_t limit)
+        : allocate(allocate), allocatorUserdata(allocatorUserdata), limit(limit)
+{
+}
+
+void* LuaMemoryBudget::Allocate(void* userdata, void* pointer, size_t oldSize, size_t newSize)
+{
+    return static_cast<LuaMemoryBudget*>(userdata)->Reallocate(pointer, oldSize, newSize);
+}
+
+void* LuaMemoryBudget::GetAllocatorUserdata() const
+{
+    return allocatorUserdata;
+}
+
+size_t LuaMemoryBudget::GetLimit() const
+{
+    return limit.load(std::memory_order_relaxed);
+}
+
+void LuaMemoryBudget::SetLimit(size_t limit)
+{
+    this->limit.store(limit, std::memory_order_relaxed);
+}
+
+size_t LuaMemoryBudget::GetLiveBytes() const
+{
+    return liveBytes.load(std::memory_order_relaxed);
+}
+
+size_t LuaMemoryBudget::GetPeakBytes() const
+{
+    return peakBytes.load(std::memory_order_relaxed);
+}
+
+size_t LuaMemoryBudget::GetAllocationCount() const
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+size_t LuaMemoryBudget::GetLiveAllocationCount() const
+{
+    return liveAllocationCount.load(std::memory_order_relaxed);
+}
+
+size_t LuaMemoryBudget::GetFailedAllocationCount() const
+{
+    return failedAllocationCount.load(std::memory_order_relaxed);
+}
+
+void* LuaMemoryBudget::Reallocate(void* pointer, size_t oldSize, size_t newSize)
+{
+    // For new blocks lua passes the type of the object being created as the old size
+    if (pointer == nullptr)
+    {
+        oldSize = 0;
+    }
+    size_t currentLiveBytes = GetLiveBytes();
+    if (newSize > oldSize)
+    {
+        size_t currentLimit = GetLimit();
+        if (currentLimit != Unlimited && currentLiveBytes + (newSize - oldSize) > currentLimit)
+        {
+            Add(failedAllocationCount, 1);
+            return nullptr;
+        }
+    }
+    void* newPointer = allocate(allocatorUserdata, pointer, oldSize, newSize);
+    if (newPointer == nullptr && newSize > 0)
+    {
+        Add(failedAllocationCount, 1);
+        return nullptr;
+    }
+    currentLiveBytes = currentLiveBytes - oldSize + newSize;
+    liveBytes.store(currentLiveBytes, std::memory_order_relaxed);
+    if (currentLiveBytes > GetPeakBytes())
+    {
+        peakBytes.store(currentLiveBytes, std::memory_order_relaxed);
+    }
+    if (pointer == nullptr)
+    {
+        Add(allocationCount, 1);
+        Add(liveAllocationCount, 1);
+    }
+    else if (newSize == 0)
+    {
+        liveAllocationCount.store(GetLiveAllocationCount() - 1, std::memory_order_relaxed);
+    }
+    return newPointer;
+}
+
+void LuaMemoryBudget::Add(std::atomic<size_t>& counter, size_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <atomic>
+#include <cstddef>
+
+// Wraps the lua_Alloc of a lua state to account for its memory and to enforce a hard limit on it. Allocations that
+// would take the live bytes over the limit fail, which makes lua raise a memory error in the script instead of the
+// process running out of memory. Freeing and shrinking never fail.
+//
+// Only the lua state allocates through the budget, but the counters can be read (and the limit changed) from other
+// threads, e.g. by a monitor deciding to shed load.
+class LuaMemoryBudget
+{
+public:
+    static constexpr size_t Unlimited = 0;
+
+private:
+    lua_Alloc allocate;
+    void* allocatorUserdata;
+    std::atomic<size_t> limit;
+    std::atomic<size_t> liveBytes = 0;
+    std::atomic<size_t> peakBytes = 0;
+    std::atomic<size_t> allocationCount = 0;
+    std::atomic<size_t> liveAllocationCount = 0;
+    std::atomic<size_t> failedAllocationCount = 0;
+
+public:
+    LuaMemoryBudget(lua_Alloc allocate, void* allocatorUserdata, size_t limit = Unlimited);
+
+    // lua_Alloc to pass to lua_newstate together with the budget as userdata.
+    static void* Allocate(void* userdata, void* pointer, size_t oldSize, size_t newSize);
+
+    void* GetAllocatorUserdata() const;
+
+    size_t GetLimit() const;
+
+    // Lowering the limit below the live bytes does not free anything, it only makes further growth fail.
+    void SetLimit(size_t limit);
+
+    size_t GetLiveBytes() const;
+
+    size_t GetPeakBytes() const;
+
+    size_t GetAllocationCount() const;
+
+    size_t GetLiveAllocationCount() const;
+
+    size_t GetFailedAllocationCount() const;
+
+private:
+    void* Reallocate(void* pointer, size_t oldSize, size_t newSize);
+
+    // Only the lua state writes the counters, so they are updated without read-modify-write instructions
+    static void Add(std::atomic<size_t>& counter, size_t value);
+};
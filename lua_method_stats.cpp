@@ -0,0 +1,125 @@
+#include "lua_method_stats.h"
+
+#include <atomic>
+
+namespace
+{
+    // Address of this key is the registry key of the method stats of a lua state
+    constexpr char MethodStatsKey = 0;
+
+    std::atomic<int> recordingMethodStatsCount = 0;
+
+    std::string GetMethodStatsName(const rttr::method& method)
+    {
+        const rttr::type& declaringType = method.get_declaring_type();
+        std::string name = declaringType.is_valid() ? declaringType.get_name().to_string() : "Global";
+        return name.append(".").append(method.get_name().to_string());
+    }
+
+    void SetIntegerField(lua_State* L, const char* key, uint64_t value)
+    {
+        lua_pushinteger(L, (lua_Integer) value);
+        lua_setfield(L, -2, key);
+    }
+}
+
+void LuaMethodStats::Histogram::Add(uint64_t duration)
+{
+    size_t bucketIndex = 0;
+    while (duration > 0 && bucketIndex < BucketCount - 1)
+    {
+        duration >>= 1;
+        bucketIndex++;
+    }
+    buckets[bucketIndex]++;
+}
+
+uint64_t LuaMethodStats::Histogram::GetPercentile(double percentile) const
+{
+    uint64_t count = 0;
+    for (uint64_t bucketCount : buckets)
+    {
+        count += bucketCount;
+    }
+    auto percentileCount = (uint64_t) ((double) count * percentile);
+    uint64_t cumulativeCount = 0;
+    for (size_t i = 0; i < BucketCount; i++)
+    {
+        cumulativeCount += buckets[i];
+        if (cumulativeCount > percentileCount || cumulativeCount == count)
+        {
+            return ((uint64_t) 1 << i) - 1;
+        }
+    }
+    return 0;
+}
+
+LuaMethodStats::LuaMethodStats(lua_State* L)
+        : L(L)
+{
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &MethodStatsKey);
+    recordingMethodStatsCount++;
+}
+
+LuaMethodStats::~LuaMethodStats()
+{
+    recordingMethodStatsCount--;
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &MethodStatsKey);
+}
+
+LuaMethodStats* LuaMethodStats::Find(lua_State* L)
+{
+    if (recordingMethodStatsCount.load(std::memory_order_relaxed) == 0)
+    {
+        return nullptr;
+    }
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &MethodStatsKey);
+    auto* methodStats = (LuaMethodStats*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return methodStats;
+}
+
+void LuaMethodStats::AddCall(const rttr::method& method, uint64_t marshallingTime, uint64_t bodyTime)
+{
+    MethodStats& stats = methodStats[&method];
+    if (stats.callCount == 0)
+    {
+        stats.name = GetMethodStatsName(method);
+    }
+    stats.callCount++;
+    stats.marshallingTime += marshallingTime;
+    stats.bodyTime += bodyTime;
+    stats.marshallingHistogram.Add(marshallingTime);
+    stats.bodyHistogram.Add(bodyTime);
+}
+
+const std::unordered_map<const rttr::method*, LuaMethodStats::MethodStats>& LuaMethodStats::GetMethodStats() const
+{
+    return methodStats;
+}
+
+void LuaMethodStats::Reset()
+{
+    methodStats.clear();
+}
+
+void LuaMethodStats::PutOnLuaStack(lua_State* L) const
+{
+    constexpr int arrayElementCount = 0;
+    lua_createtable(L, arrayElementCount, (int) methodStats.size());
+    for (const auto& [method, stats] : methodStats)
+    {
+        constexpr int fieldCount = 7;
+        lua_createtable(L, arrayElementCount, fieldCount);
+        SetIntegerField(L, "calls", stats.callCount);
+        SetIntegerField(L, "marshallingTime", stats.marshallingTime);
+        SetIntegerField(L, "bodyTime", stats.bodyTime);
+        SetIntegerField(L, "marshallingP50", stats.marshallingHistogram.GetPercentile(0.5));
+        SetIntegerField(L, "marshallingP99", stats.marshallingHistogram.GetPercentile(0.99));
+        SetIntegerField(L, "bodyP50", stats.bodyHistogram.GetPercentile(0.5));
+        SetIntegerField(L, "bodyP99", stats.bodyHistogram.GetPercentile(0.99));
+        lua_setfield(L, -2, stats.name.c_str());
+    }
+}
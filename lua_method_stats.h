@@ -0,0 +1,67 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <rttr/type>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Counts the calls from lua to each bound native method of a lua state and records their latency, split into the
+// time spent marshalling (reading the arguments from and putting the results on the lua stack) and the time spent in
+// the native method itself. Methods bound through thunks read their arguments as part of the call, so all of their time
+// counts as body time. Batch calls count one call per instance.
+class LuaMethodStats
+{
+public:
+    // Bucket i counts the durations in [2^(i-1), 2^i) nanoseconds, the last bucket everything above.
+    struct Histogram
+    {
+        static constexpr size_t BucketCount = 40;
+
+        std::array<uint64_t, BucketCount> buckets = {};
+
+        void Add(uint64_t duration);
+
+        // Upper bound of the bucket that holds the percentile, e.g. 0.99 for the 99th percentile.
+        uint64_t GetPercentile(double percentile) const;
+    };
+
+    struct MethodStats
+    {
+        std::string name;
+        uint64_t callCount = 0;
+        uint64_t marshallingTime = 0;
+        uint64_t bodyTime = 0;
+        Histogram marshallingHistogram;
+        Histogram bodyHistogram;
+    };
+
+private:
+    lua_State* L;
+    std::unordered_map<const rttr::method*, MethodStats> methodStats;
+
+public:
+    // Starts recording the calls of the lua state until the stats are destroyed.
+    explicit LuaMethodStats(lua_State* L);
+
+    ~LuaMethodStats();
+
+    LuaMethodStats(const LuaMethodStats&) = delete;
+
+    LuaMethodStats& operator=(const LuaMethodStats&) = delete;
+
+    // Returns nullptr, without touching the lua state, while no stats are recorded at all.
+    static LuaMethodStats* Find(lua_State* L);
+
+    // Durations are in nanoseconds.
+    void AddCall(const rttr::method& method, uint64_t marshallingTime, uint64_t bodyTime);
+
+    const std::unordered_map<const rttr::method*, MethodStats>& GetMethodStats() const;
+
+    void Reset();
+
+    // Puts a table on the lua stack with a table of counters per method name, e.g.
+    // stats["Sprite.Move"] = { calls, marshallingTime, bodyTime, marshallingP50, marshallingP99, bodyP50, bodyP99 }
+    void PutOnLuaStack(lua_State* L) const;
+};
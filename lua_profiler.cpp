@@ -0,0 +1,169 @@
+#include "lua_profiler.h"
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    // Address of this key is the registry key of the profiler of a lua state
+    constexpr char ProfilerKey = 0;
+
+    std::atomic<int> runningProfilerCount = 0;
+
+    // Semicolons separate the frames of a folded stack, and the last space separates the weight
+    void AppendFrameName(std::string& stack, const char* name)
+    {
+        for (const char* character = name; *character != '\0'; character++)
+        {
+            stack.push_back(*character == ';' ? ',' : *character);
+        }
+    }
+}
+
+LuaProfiler::LuaProfiler(lua_State* L, uint64_t samplePeriod, uint64_t nativeSamplePeriod)
+        : L(L), samplePeriod(samplePeriod), nativeSamplePeriod(nativeSamplePeriod), lastSampleTime(GetTime())
+{
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &ProfilerKey);
+    runningProfilerCount++;
+    lua_sethook(L, Hook, LUA_MASKCOUNT, HookInstructionCount);
+    LOG_DEBUG("started lua profiler sampling every [%d] microseconds", (int) (samplePeriod / 1000));
+}
+
+LuaProfiler::~LuaProfiler()
+{
+    runningProfilerCount--;
+    lua_sethook(L, nullptr, 0, 0);
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &ProfilerKey);
+}
+
+LuaProfiler* LuaProfiler::Find(lua_State* L)
+{
+    if (runningProfilerCount.load(std::memory_order_relaxed) == 0)
+    {
+        return nullptr;
+    }
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &ProfilerKey);
+    auto* profiler = (LuaProfiler*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return profiler;
+}
+
+uint64_t LuaProfiler::GetTime()
+{
+    const auto& sinceEpoch = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count();
+}
+
+void LuaProfiler::AddNativeCall(lua_State* L, std::string_view methodName, uint64_t startTime)
+{
+    uint64_t duration = GetTime() - startTime;
+    nativeTimeSinceSample += duration;
+    unsampledNativeTime += duration;
+    if (unsampledNativeTime >= nativeSamplePeriod)
+    {
+        AddSample(L, methodName, unsampledNativeTime);
+        unsampledNativeTime = 0;
+    }
+}
+
+std::string LuaProfiler::GetFoldedStacks() const
+{
+    std::vector<std::pair<std::string_view, uint64_t>> sortedStacks(foldedStacks.begin(), foldedStacks.end());
+    std::sort(sortedStacks.begin(), sortedStacks.end());
+    std::string folded;
+    for (const auto& [foldedStack, weight] : sortedStacks)
+    {
+        constexpr uint64_t nanosecondsPerMicrosecond = 1000;
+        folded.append(foldedStack).append(" ").append(std::to_string(weight / nanosecondsPerMicrosecond)).append("\n");
+    }
+    return folded;
+}
+
+bool LuaProfiler::WriteFoldedStacks(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        LOG_WARN("could not open [%s] to write lua profile", path);
+        return false;
+    }
+    const std::string& folded = GetFoldedStacks();
+    bool written = fwrite(folded.data(), 1, folded.size(), file) == folded.size();
+    fclose(file);
+    return written;
+}
+
+void LuaProfiler::Hook(lua_State* L, lua_Debug* debug)
+{
+    if (debug->event != LUA_HOOKCOUNT)
+    {
+        return;
+    }
+    LuaProfiler* profiler = Find(L);
+    if (profiler == nullptr)
+    {
+        return;
+    }
+    uint64_t time = GetTime();
+    uint64_t elapsedTime = time - profiler->lastSampleTime;
+    uint64_t interpretedTime = elapsedTime > profiler->nativeTimeSinceSample ? elapsedTime - profiler->nativeTimeSinceSample : 0;
+    if (interpretedTime < profiler->samplePeriod)
+    {
+        return;
+    }
+    profiler->AddSample(L, {}, interpretedTime);
+    profiler->lastSampleTime = time;
+    profiler->nativeTimeSinceSample = 0;
+}
+
+void LuaProfiler::AddSample(lua_State* L, std::string_view nativeFrame, uint64_t weight)
+{
+    stack.clear();
+    PutStack(L);
+    if (!nativeFrame.empty())
+    {
+        stack.append(stack.empty() ? "" : ";").append("[native] ").append(nativeFrame);
+    }
+    foldedStacks[stack] += weight;
+}
+
+// Frames are named "function source:line", with the current line for the innermost lua function and the line the
+// function is defined on for its callers, and are put root first.
+void LuaProfiler::PutStack(lua_State* L)
+{
+    std::vector<lua_Debug> frames;
+    lua_Debug frame;
+    for (int level = 0; lua_getstack(L, level, &frame) != 0; level++)
+    {
+        lua_getinfo(L, "Snl", &frame);
+        frames.push_back(frame);
+    }
+    for (size_t i = frames.size(); i-- > 0;)
+    {
+        const lua_Debug& debug = frames[i];
+        if (!stack.empty())
+        {
+            stack.push_back(';');
+        }
+        if (debug.what[0] == 'C')
+        {
+            stack.append("[C] ");
+            AppendFrameName(stack, debug.name != nullptr ? debug.name : "?");
+            continue;
+        }
+        bool isMainChunk = strcmp(debug.what, "main") == 0;
+        AppendFrameName(stack, debug.name != nullptr ? debug.name : isMainChunk ? "main chunk" : "?");
+        stack.push_back(' ');
+        AppendFrameName(stack, debug.short_src);
+        bool isInnermostLuaFrame = i == 0 || (i == 1 && frames[0].what[0] == 'C');
+        stack.push_back(':');
+        stack.append(std::to_string(isInnermostLuaFrame ? debug.currentline : debug.linedefined));
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Sampling profiler for the scripts of a lua state. A count hook checks the time every HookInstructionCount
+// instructions and samples the lua call stack once the interpreted time since the previous sample adds up to
+// samplePeriod, weighing the sample with that time. Checking the time on every instruction would make a tight lua loop
+// about 2x slower, this way the checks stay out of the profile. The hook is set on the thread using the lua state, as
+// lua_sethook must not be called from another thread. Only the lua state itself is hooked, not lua threads
+// (coroutines) running on it. Time spent in native (rttr) methods called from lua is reported separately: the binding
+// reports every native call, and once the native time adds up to nativeSamplePeriod the lua stack is sampled with the
+// method as an extra "[native]" frame on top. The native time is left out of the interpreted time, so lua samples do
+// not pile up right after long native calls.
+//
+// The results are folded stacks ("frame;frame;frame weight", weights in microseconds) as used by flame graph tools.
+class LuaProfiler
+{
+public:
+    static constexpr uint64_t DefaultSamplePeriod = 1000000;
+    static constexpr uint64_t DefaultNativeSamplePeriod = 1000000;
+    static constexpr int HookInstructionCount = 1000;
+
+private:
+    lua_State* L;
+    uint64_t samplePeriod;
+    uint64_t nativeSamplePeriod;
+    uint64_t lastSampleTime;
+    uint64_t nativeTimeSinceSample = 0;
+    uint64_t unsampledNativeTime = 0;
+    std::unordered_map<std::string, uint64_t> foldedStacks;
+    std::string stack;
+
+public:
+    // Starts profiling the lua state until the profiler is destroyed, which has to happen on the thread using the lua
+    // state. Periods are in nanoseconds.
+    explicit LuaProfiler(lua_State* L, uint64_t samplePeriod = DefaultSamplePeriod, uint64_t nativeSamplePeriod = DefaultNativeSamplePeriod);
+
+    ~LuaProfiler();
+
+    LuaProfiler(const LuaProfiler&) = delete;
+
+    LuaProfiler& operator=(const LuaProfiler&) = delete;
+
+    // Returns nullptr, without touching the lua state, while no profiler is running at all.
+    static LuaProfiler* Find(lua_State* L);
+
+    // Monotonic time in nanoseconds, to pass as the start time of native calls.
+    static uint64_t GetTime();
+
+    void AddNativeCall(lua_State* L, std::string_view methodName, uint64_t startTime);
+
+    std::string GetFoldedStacks() const;
+
+    bool WriteFoldedStacks(const char* path) const;
+
+private:
+    static void Hook(lua_State* L, lua_Debug* debug);
+
+    void AddSample(lua_State* L, std::string_view nativeFrame, uint64_t weight);
+
+    void PutStack(lua_State* L);
+};
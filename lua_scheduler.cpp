@@ -0,0 +1,146 @@
+#include "lua_scheduler.h"
+#include "log.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    // Lets jobs submitted from a worker go to the deque of that worker
+    thread_local const void* currentScheduler = nullptr;
+    thread_local size_t currentWorkerIndex = 0;
+}
+
+LuaScheduler::LuaScheduler(size_t workerCount, const CreateStateFunction& createState, DestroyStateFunction destroyState)
+        : destroyState(std::move(destroyState))
+{
+    workerCount = std::max<size_t>(workerCount, 1);
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        auto worker = std::make_unique<Worker>();
+        worker->L = createState();
+        if (worker->L == nullptr)
+        {
+            for (const auto& createdWorker : workers)
+            {
+                this->destroyState(createdWorker->L);
+            }
+            throw std::runtime_error("could not create lua state for scheduler worker [" + std::to_string(i) + "]");
+        }
+        workers.push_back(std::move(worker));
+    }
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        workers[i]->thread = std::thread(&LuaScheduler::RunWorker, this, i);
+    }
+    LOG_DEBUG("started lua scheduler with [%d] workers", (int) workerCount);
+}
+
+LuaScheduler::~LuaScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (const auto& worker : workers)
+    {
+        worker->thread.join();
+        destroyState(worker->L);
+    }
+}
+
+size_t LuaScheduler::GetWorkerCount() const
+{
+    return workers.size();
+}
+
+void LuaScheduler::Push(std::unique_ptr<Job> job)
+{
+    size_t workerIndex;
+    if (currentScheduler == this)
+    {
+        workerIndex = currentWorkerIndex;
+    }
+    else
+    {
+        workerIndex = nextWorkerIndex.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    }
+
+    // The count changes together with the deques, so a woken worker never finds a counted job that is not queued yet
+    {
+        Worker& worker = *workers[workerIndex];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+        queuedJobCount++;
+    }
+    {
+        // A worker checks the count under this lock before it sleeps, so it either sees the job or gets the notification
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeCondition.notify_one();
+}
+
+std::unique_ptr<LuaScheduler::Job> LuaScheduler::Pop(size_t workerIndex)
+{
+    Worker& worker = *workers[workerIndex];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.jobs.empty())
+    {
+        return nullptr;
+    }
+    std::unique_ptr<Job> job = std::move(worker.jobs.back());
+    worker.jobs.pop_back();
+    queuedJobCount--;
+    return job;
+}
+
+std::unique_ptr<LuaScheduler::Job> LuaScheduler::Steal(size_t workerIndex)
+{
+    for (size_t i = 1; i < workers.size(); i++)
+    {
+        Worker& victim = *workers[(workerIndex + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            std::unique_ptr<Job> job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queuedJobCount--;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void LuaScheduler::RunWorker(size_t workerIndex)
+{
+    currentScheduler = this;
+    currentWorkerIndex = workerIndex;
+    lua_State* L = workers[workerIndex]->L;
+    while (true)
+    {
+        std::unique_ptr<Job> job = Pop(workerIndex);
+        if (job == nullptr)
+        {
+            job = Steal(workerIndex);
+        }
+        if (job != nullptr)
+        {
+            RunJob(L, *job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeCondition.wait(lock, [this]() { return stopping || queuedJobCount > 0; });
+        if (stopping && queuedJobCount == 0)
+        {
+            return;
+        }
+    }
+}
+
+// Jobs leave whatever they did not pop behind, the next job starts with an empty lua stack
+void LuaScheduler::RunJob(lua_State* L, Job& job)
+{
+    job.Run(L);
+    lua_settop(L, 0);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Runs jobs on a fixed set of worker threads that each own one bound lua state. A job is a callable that gets the
+// lua state of the worker running it, e.g. to call a lua function with native arguments, and its result is returned
+// through a future.
+//
+// Every worker has its own deque of jobs. Jobs submitted from a worker go to the back of its own deque, other jobs
+// are spread over the workers. A worker takes jobs from the back of its own deque and, when that is empty, steals from
+// the front of the others.
+//
+// Lua is compiled as C, so a lua error is a longjmp that would skip the destructors of the C++ frames of a job. Jobs
+// therefore run outside of any lua call and must not raise lua errors: they do their lua work through protected calls
+// (lua_pcall, e.g. CallLuaMethodFromNative) and report failures by throwing, which fails their future with the
+// exception. An unprotected lua error in a job ends up in the panic function of the lua state.
+class LuaScheduler
+{
+public:
+    using CreateStateFunction = std::function<lua_State*()>;
+    using DestroyStateFunction = std::function<void(lua_State*)>;
+
+private:
+    struct Job
+    {
+        virtual ~Job() = default;
+
+        virtual void Run(lua_State* L) = 0;
+    };
+
+    template<typename Function, typename Result>
+    struct TypedJob : Job
+    {
+        Function function;
+        std::promise<Result> promise;
+
+        explicit TypedJob(Function&& function)
+                : function(std::move(function))
+        {
+        }
+
+        void Run(lua_State* L) override
+        {
+            try
+            {
+                if constexpr (std::is_void_v<Result>)
+                {
+                    function(L);
+                    promise.set_value();
+                }
+                else
+                {
+                    promise.set_value(function(L));
+                }
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    };
+
+    struct Worker
+    {
+        lua_State* L;
+        std::thread thread;
+        std::deque<std::unique_ptr<Job>> jobs;
+        std::mutex mutex;
+    };
+
+    DestroyStateFunction destroyState;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> queuedJobCount = 0;
+    std::atomic<size_t> nextWorkerIndex = 0;
+    std::mutex sleepMutex;
+    std::condition_variable wakeCondition;
+    bool stopping = false;
+
+public:
+    // Creates one lua state per worker on the calling thread before starting the workers. Throws std::runtime_error,
+    // after destroying the lua states created so far, when createState returns nullptr.
+    LuaScheduler(size_t workerCount, const CreateStateFunction& createState, DestroyStateFunction destroyState);
+
+    // Finishes all submitted jobs before stopping the workers and destroying their lua states.
+    ~LuaScheduler();
+
+    LuaScheduler(const LuaScheduler&) = delete;
+
+    LuaScheduler& operator=(const LuaScheduler&) = delete;
+
+    size_t GetWorkerCount() const;
+
+    template<typename Function>
+    auto Submit(Function&& function) -> std::future<std::invoke_result_t<std::decay_t<Function>&, lua_State*>>
+    {
+        using Result = std::invoke_result_t<std::decay_t<Function>&, lua_State*>;
+        auto job = std::make_unique<TypedJob<std::decay_t<Function>, Result>>(std::forward<Function>(function));
+        std::future<Result> future = job->promise.get_future();
+        Push(std::move(job));
+        return future;
+    }
+
+private:
+    void Push(std::unique_ptr<Job> job);
+
+    std::unique_ptr<Job> Pop(size_t workerIndex);
+
+    std::unique_ptr<Job> Steal(size_t workerIndex);
+
+    void RunWorker(size_t workerIndex);
+
+    static void RunJob(lua_State* L, Job& job);
+};
@@ -0,0 +1,198 @@
+#include "lua_state_pool.h"
+#include "log.h"
+#include "lua_function_ref.h"
+
+#include <utility>
+
+namespace
+{
+    constexpr char GlobalsSnapshotKey = 0;
+}
+
+LuaStatePool::Lease::Lease(LuaStatePool* pool, lua_State* L)
+        : pool(pool), L(L)
+{
+}
+
+LuaStatePool::Lease::Lease(Lease&& other) noexcept
+        : pool(other.pool), L(std::exchange(other.L, nullptr)), tainted(other.tainted)
+{
+}
+
+LuaStatePool::Lease& LuaStatePool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        pool = other.pool;
+        L = std::exchange(other.L, nullptr);
+        tainted = other.tainted;
+    }
+    return *this;
+}
+
+LuaStatePool::Lease::~Lease()
+{
+    Release();
+}
+
+lua_State* LuaStatePool::Lease::Get() const
+{
+    return L;
+}
+
+void LuaStatePool::Lease::Taint()
+{
+    tainted = true;
+}
+
+void LuaStatePool::Lease::Release()
+{
+    if (L != nullptr)
+    {
+        pool->Release(std::exchange(L, nullptr), tainted);
+    }
+}
+
+LuaStatePool::LuaStatePool(size_t capacity, CreateStateFunction createState, DestroyStateFunction destroyState)
+        : createState(std::move(createState)), destroyState(std::move(destroyState)), capacity(capacity)
+{
+    idleStates.reserve(capacity);
+    for (size_t i = 0; i < capacity; i++)
+    {
+        lua_State* L = CreateState();
+        if (L != nullptr)
+        {
+            idleStates.push_back(L);
+        }
+    }
+    LOG_DEBUG("created pool of [%d] lua states", (int) idleStates.size());
+}
+
+LuaStatePool::~LuaStatePool()
+{
+    for (lua_State* L : idleStates)
+    {
+        destroyState(L);
+    }
+}
+
+LuaStatePool::Lease LuaStatePool::Acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idleStates.empty())
+        {
+            lua_State* L = idleStates.back();
+            idleStates.pop_back();
+            return Lease(this, L);
+        }
+    }
+    LOG_WARN("lua state pool is empty, creating a new state");
+    return Lease(this, CreateState());
+}
+
+size_t LuaStatePool::GetIdleCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return idleStates.size();
+}
+
+lua_State* LuaStatePool::CreateState()
+{
+    lua_State* L = createState();
+    if (L != nullptr)
+    {
+        SnapshotGlobals(L);
+    }
+    return L;
+}
+
+void LuaStatePool::Release(lua_State* L, bool tainted)
+{
+    if (L == nullptr)
+    {
+        return;
+    }
+    if (!tainted && ResetState(L))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idleStates.size() < capacity)
+        {
+            idleStates.push_back(L);
+            return;
+        }
+    }
+    LOG_DEBUG("destroying lua state returned to the pool");
+    destroyState(L);
+}
+
+void LuaStatePool::SnapshotGlobals(lua_State* L)
+{
+    lua_newtable(L);
+    lua_pushglobaltable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0)
+    {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, -5);
+    }
+    lua_pop(L, 1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &GlobalsSnapshotKey);
+}
+
+bool LuaStatePool::ResetState(lua_State* L)
+{
+    if (lua_status(L) != LUA_OK)
+    {
+        return false;
+    }
+    lua_settop(L, 0);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &GlobalsSnapshotKey);
+    lua_pushglobaltable(L);
+    constexpr int snapshotIndex = 1;
+    constexpr int globalsIndex = 2;
+
+    // Assigning to existing fields (including removing them) is allowed while traversing with lua_next
+    lua_pushnil(L);
+    while (lua_next(L, globalsIndex) != 0)
+    {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, snapshotIndex);
+        if (!lua_rawequal(L, -1, -2))
+        {
+            lua_pushvalue(L, -3);
+            lua_insert(L, -2);
+            lua_rawset(L, globalsIndex);
+            lua_pop(L, 1);
+        }
+        else
+        {
+            lua_pop(L, 2);
+        }
+    }
+
+    // Globals that were removed or set to nil are restored after the traversal, adding fields during it is not allowed
+    lua_pushnil(L);
+    while (lua_next(L, snapshotIndex) != 0)
+    {
+        lua_pushvalue(L, -2);
+        if (lua_rawget(L, globalsIndex) == LUA_TNIL)
+        {
+            lua_pop(L, 1);
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, globalsIndex);
+        }
+        else
+        {
+            lua_pop(L, 2);
+        }
+    }
+    lua_settop(L, 0);
+
+    // Functions resolved during the lease may have been redefined by it
+    LuaFunctionRef::InvalidateAll(L);
+    return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Keeps fully bound and script-loaded lua states around so that handing one out for a request does not pay for
+// binding the registered types or compiling scripts. The globals of a state are snapshotted once it has been
+// created, and a returned state is reset by restoring that snapshot (shallowly: tables reachable from the globals
+// are not restored), which also invalidates the LuaFunctionRefs of the state. A state that is returned tainted, e.g.
+// after a script error, is destroyed instead of reused.
+//
+// The pool can be used from multiple threads, a state from one thread at a time.
+class LuaStatePool
+{
+public:
+    using CreateStateFunction = std::function<lua_State*()>;
+    using DestroyStateFunction = std::function<void(lua_State*)>;
+
+    // Returns the state to the pool when it goes out of scope.
+    class Lease
+    {
+    private:
+        LuaStatePool* pool;
+        lua_State* L;
+        bool tainted = false;
+
+    public:
+        Lease(LuaStatePool* pool, lua_State* L);
+
+        Lease(Lease&& other) noexcept;
+
+        Lease& operator=(Lease&& other) noexcept;
+
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+
+        Lease& operator=(const Lease&) = delete;
+
+        lua_State* Get() const;
+
+        // Makes the pool destroy the state on return instead of resetting it.
+        void Taint();
+
+    private:
+        void Release();
+    };
+
+private:
+    CreateStateFunction createState;
+    DestroyStateFunction destroyState;
+    size_t capacity;
+    std::vector<lua_State*> idleStates;
+    mutable std::mutex mutex;
+
+public:
+    // Creates capacity states up front. When the pool runs dry more states are created on demand, and returned states
+    // beyond the capacity are destroyed.
+    LuaStatePool(size_t capacity, CreateStateFunction createState, DestroyStateFunction destroyState);
+
+    ~LuaStatePool();
+
+    LuaStatePool(const LuaStatePool&) = delete;
+
+    LuaStatePool& operator=(const LuaStatePool&) = delete;
+
+    Lease Acquire();
+
+    size_t GetIdleCount() const;
+
+private:
+    lua_State* CreateState();
+
+    void Release(lua_State* L, bool tainted);
+
+    static void SnapshotGlobals(lua_State* L);
+
+    static bool ResetState(lua_State* L);
+};
@@ -0,0 +1,232 @@
+#include "lua_tasks.h"
+#include "log.h"
+
+#include <atomic>
+#include <utility>
+
+namespace
+{
+    // Address of this key is the registry key of the task runner of a lua state
+    constexpr char TaskRunnerKey = 0;
+
+    std::atomic<LuaTaskRunner::OperationId> nextOperationId = 1;
+
+    // Operations are completed through their id only, so the runner an operation belongs to is looked up here. An
+    // operation that completes before its task got suspended is kept by its runner until the task awaits it.
+    std::mutex operationMutex;
+    std::unordered_map<LuaTaskRunner::OperationId, LuaTaskRunner*> operationTaskRunners;
+
+    // Set by PrepareAwait for the native method about to begin an operation, cleared by Await or CancelAwait
+    thread_local LuaTaskRunner* preparingTaskRunner = nullptr;
+}
+
+LuaTaskRunner::LuaTaskRunner(lua_State* L)
+        : L(L)
+{
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &TaskRunnerKey);
+}
+
+LuaTaskRunner::~LuaTaskRunner()
+{
+    if (preparingTaskRunner == this)
+    {
+        preparingTaskRunner = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(operationMutex);
+        for (auto iterator = operationTaskRunners.begin(); iterator != operationTaskRunners.end();)
+        {
+            iterator = iterator->second == this ? operationTaskRunners.erase(iterator) : std::next(iterator);
+        }
+    }
+    for (const auto& [thread, task] : tasks)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, task.reference);
+    }
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &TaskRunnerKey);
+}
+
+void LuaTaskRunner::Start(int argumentCount)
+{
+    lua_State* thread = lua_newthread(L);
+    lua_insert(L, -(argumentCount + 2));
+    lua_xmove(L, thread, argumentCount + 1);
+    int reference = luaL_ref(L, LUA_REGISTRYINDEX);
+    tasks[thread] = {reference, 0};
+    LOG_TRACE("started lua task with [%d] arguments", argumentCount);
+    Resume(thread, argumentCount);
+}
+
+size_t LuaTaskRunner::Poll()
+{
+    std::vector<Completion> completedOperations;
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completedOperations.swap(completions);
+    }
+    std::vector<lua_State*> threads;
+    threads.swap(yieldedThreads);
+
+    size_t resumedCount = 0;
+    for (Completion& completion : completedOperations)
+    {
+        {
+            std::lock_guard<std::mutex> lock(operationMutex);
+            operationTaskRunners.erase(completion.operationId);
+        }
+        auto iterator = awaitingThreads.find(completion.operationId);
+        if (iterator == awaitingThreads.end())
+        {
+            LOG_TRACE("operation [%d] completed before its lua task awaited it", (int) completion.operationId);
+            earlyCompletions[completion.operationId] = std::move(completion.pushResults);
+            continue;
+        }
+        lua_State* thread = iterator->second;
+        awaitingThreads.erase(iterator);
+        tasks[thread].operationId = 0;
+        int resultCount = completion.pushResults != nullptr ? completion.pushResults(thread) : 0;
+        Resume(thread, resultCount);
+        resumedCount++;
+    }
+    for (lua_State* thread : threads)
+    {
+        Resume(thread, 0);
+        resumedCount++;
+    }
+    return resumedCount;
+}
+
+void LuaTaskRunner::WaitForCompletions()
+{
+    if (tasks.empty() || !yieldedThreads.empty())
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(completionMutex);
+    completionCondition.wait(lock, [this]() { return !completions.empty(); });
+}
+
+size_t LuaTaskRunner::GetTaskCount() const
+{
+    return tasks.size();
+}
+
+std::vector<std::string> LuaTaskRunner::TakeErrors()
+{
+    std::vector<std::string> takenErrors;
+    takenErrors.swap(errors);
+    return takenErrors;
+}
+
+bool LuaTaskRunner::PrepareAwait(lua_State* L)
+{
+    LuaTaskRunner* taskRunner = GetTaskRunner(L);
+    if (taskRunner == nullptr || taskRunner->tasks.find(L) == taskRunner->tasks.end() || !lua_isyieldable(L))
+    {
+        return false;
+    }
+    preparingTaskRunner = taskRunner;
+    return true;
+}
+
+void LuaTaskRunner::CancelAwait()
+{
+    preparingTaskRunner = nullptr;
+}
+
+LuaAwait LuaTaskRunner::BeginOperation()
+{
+    OperationId operationId = nextOperationId.fetch_add(1, std::memory_order_relaxed);
+    if (preparingTaskRunner != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(operationMutex);
+        operationTaskRunners[operationId] = preparingTaskRunner;
+    }
+    return {operationId};
+}
+
+void LuaTaskRunner::Complete(OperationId operationId, PushResultsFunction pushResults)
+{
+    std::lock_guard<std::mutex> lock(operationMutex);
+    auto iterator = operationTaskRunners.find(operationId);
+    if (iterator == operationTaskRunners.end())
+    {
+        LOG_TRACE("dropping completion of operation [%d] without task runner", (int) operationId);
+        return;
+    }
+    iterator->second->Post({operationId, std::move(pushResults)});
+}
+
+int LuaTaskRunner::Await(lua_State* L, OperationId operationId)
+{
+    preparingTaskRunner = nullptr;
+    LuaTaskRunner* taskRunner = GetTaskRunner(L);
+    if (taskRunner == nullptr || taskRunner->tasks.find(L) == taskRunner->tasks.end() || !lua_isyieldable(L))
+    {
+        return luaL_error(L, "can only await operation [%I] from a lua task\n", (lua_Integer) operationId);
+    }
+    auto earlyCompletion = taskRunner->earlyCompletions.find(operationId);
+    if (earlyCompletion != taskRunner->earlyCompletions.end())
+    {
+        taskRunner->Post({operationId, std::move(earlyCompletion->second)});
+        taskRunner->earlyCompletions.erase(earlyCompletion);
+    }
+    else if (!taskRunner->IsOwnOperation(operationId))
+    {
+        return luaL_error(L, "operation [%I] was not begun for this task runner\n", (lua_Integer) operationId);
+    }
+    taskRunner->tasks[L].operationId = operationId;
+    taskRunner->awaitingThreads[operationId] = L;
+    LOG_TRACE("suspending lua task until operation [%d] completes", (int) operationId);
+    return lua_yield(L, 0);
+}
+
+bool LuaTaskRunner::IsOwnOperation(OperationId operationId) const
+{
+    std::lock_guard<std::mutex> lock(operationMutex);
+    auto iterator = operationTaskRunners.find(operationId);
+    return iterator != operationTaskRunners.end() && iterator->second == this;
+}
+
+LuaTaskRunner* LuaTaskRunner::GetTaskRunner(lua_State* L)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &TaskRunnerKey);
+    auto* taskRunner = (LuaTaskRunner*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return taskRunner;
+}
+
+void LuaTaskRunner::Post(Completion&& completion)
+{
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completions.push_back(std::move(completion));
+    }
+    completionCondition.notify_one();
+}
+
+void LuaTaskRunner::Resume(lua_State* thread, int argumentCount)
+{
+    int resultCount = 0;
+    int status = lua_resume(thread, L, argumentCount, &resultCount);
+    if (status == LUA_YIELD)
+    {
+        lua_pop(thread, resultCount);
+        if (tasks[thread].operationId == 0)
+        {
+            yieldedThreads.push_back(thread);
+        }
+        return;
+    }
+    if (status != LUA_OK)
+    {
+        errors.emplace_back(lua_isstring(thread, -1) ? lua_tostring(thread, -1) : "error object is not a string");
+        LOG_WARN("lua task failed: %s", errors.back().c_str());
+    }
+    auto iterator = tasks.find(thread);
+    luaL_unref(L, LUA_REGISTRYINDEX, iterator->second.reference);
+    tasks.erase(iterator);
+    LOG_TRACE("finished lua task, [%d] tasks left", (int) tasks.size());
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Returned by a bound native method to suspend the calling lua task until the operation completes, e.g.
+// rttr::registration::method("Delay", &Delay) with LuaAwait Delay(int milliseconds). The results the operation
+// completes with become the results of the method call in lua.
+struct LuaAwait
+{
+    uint64_t operationId;
+};
+
+// Runs lua functions as tasks on lua threads of one lua state, so that a task waiting on a native operation (a timer,
+// an I/O completion) is suspended with lua_yield instead of blocking the host thread, and many tasks can be in flight
+// on a single thread. The runner and its lua state belong to one host thread, which calls Poll to resume the tasks
+// whose operations completed. Operations can be completed from any thread.
+class LuaTaskRunner
+{
+public:
+    using OperationId = uint64_t;
+
+    // Pushes the results of a completed operation onto the lua stack of the task and returns how many it pushed.
+    using PushResultsFunction = std::function<int(lua_State* L)>;
+
+private:
+    struct Task
+    {
+        int reference;
+        OperationId operationId;
+    };
+
+    struct Completion
+    {
+        OperationId operationId;
+        PushResultsFunction pushResults;
+    };
+
+    lua_State* L;
+    std::unordered_map<lua_State*, Task> tasks;
+    std::unordered_map<OperationId, lua_State*> awaitingThreads;
+    std::unordered_map<OperationId, PushResultsFunction> earlyCompletions;
+    std::vector<lua_State*> yieldedThreads;
+    std::vector<Completion> completions;
+    std::vector<std::string> errors;
+    std::mutex completionMutex;
+    std::condition_variable completionCondition;
+
+public:
+    explicit LuaTaskRunner(lua_State* L);
+
+    ~LuaTaskRunner();
+
+    LuaTaskRunner(const LuaTaskRunner&) = delete;
+
+    LuaTaskRunner& operator=(const LuaTaskRunner&) = delete;
+
+    // Starts the function on top of the lua stack, below its arguments, as a new task and runs it until it finishes
+    // or suspends. Pops the function and its arguments.
+    void Start(int argumentCount);
+
+    // Resumes the tasks whose operations completed since the last poll, and returns how many tasks it resumed.
+    size_t Poll();
+
+    // Blocks until an operation completes (or a task yielded on its own), unless there are no tasks to wait for.
+    void WaitForCompletions();
+
+    size_t GetTaskCount() const;
+
+    // Returns the errors of the tasks that failed since the last call, in the order they failed, and forgets them.
+    std::vector<std::string> TakeErrors();
+
+    // Checks that the calling lua thread is a task that can be suspended, before the native operation is started.
+    // Operations begun on this host thread until the next Await or CancelAwait belong to the task runner of that task.
+    // Returns false, without raising a lua error, when the operation could never be awaited.
+    static bool PrepareAwait(lua_State* L);
+
+    // Ends what PrepareAwait started without awaiting, e.g. when the native method failed. Await ends it as well.
+    static void CancelAwait();
+
+    // Operations begun outside of PrepareAwait/Await belong to no task runner, so their completions are dropped.
+    static LuaAwait BeginOperation();
+
+    // Can be called from any thread, also before the task that waits on the operation got suspended. Completions of
+    // operations whose task runner was destroyed in the meantime are dropped.
+    static void Complete(OperationId operationId, PushResultsFunction pushResults = nullptr);
+
+    // Suspends the calling task until the operation completes. Has to be the return expression of a lua_CFunction, and
+    // the C++ objects of that function have to be destroyed before calling it, since lua_yield does not return.
+    static int Await(lua_State* L, OperationId operationId);
+
+private:
+    static LuaTaskRunner* GetTaskRunner(lua_State* L);
+
+    bool IsOwnOperation(OperationId operationId) const;
+
+    void Post(Completion&& completion);
+
+    void Resume(lua_State* thread, int argumentCount);
+};
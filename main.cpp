@@ -1,6 +1,21 @@
 #include <lua/lua.hpp>
 #include <rttr/registration>
 #include <iostream>
+#include <cstdio>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "log.h"
+#include "lua_binding.h"
+#include "lua_method_stats.h"
+#include "lua_profiler.h"
+#include "lua_state_pool.h"
+#include "lua_tasks.h"
 
 extern void printLua(lua_State* L, const std::string& tag);
 
@@ -14,6 +29,21 @@ void HelloWorldWithArguments(int x, int y)
     printf("--- Hello World from LUA (%d, %d)\n", x, y);
 }
 
+LuaAwait Delay(int milliseconds)
+{
+    LuaAwait operation = LuaTaskRunner::BeginOperation();
+    std::thread([operation, milliseconds]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+        LuaTaskRunner::Complete(operation.operationId, [milliseconds](lua_State* L)
+        {
+            lua_pushinteger(L, milliseconds);
+            return 1;
+        });
+    }).detach();
+    return operation;
+}
+
 class Sprite
 {
 public:
@@ -50,549 +80,13 @@ RTTR_REGISTRATION
 {
     rttr::registration::method("HelloWorld", &HelloWorld);
     rttr::registration::method("HelloWorldWithArguments", &HelloWorldWithArguments);
-    rttr::registration::class_<Sprite>("Sprite")
+    rttr::registration::method("Delay", &Delay);
+    rttr::registration::class_<Sprite>("Sprite")(rttr::metadata(LuaMetadata::Pool, true), LuaInlineStorageMetadata<Sprite>())
             .constructor()
-            .method("Move", &Sprite::Move)
+            .method("Move", &Sprite::Move)(LuaThunkMetadata<&Sprite::Move>())
             .method("Draw", &Sprite::Draw)
-            .property("x", &Sprite::x)
-            .property("y", &Sprite::y);
-}
-
-union ArgumentValue
-{
-    int intValue;
-    long longValue;
-    float floatValue;
-    double doubleValue;
-    const char* stringValue;
-};
-
-int CreateUserdata(lua_State* L, const rttr::variant& variant);
-
-int PutOnLuaStack(lua_State* L, const rttr::variant& variant)
-{
-    const std::string& typeName = variant.get_type().get_name().to_string();
-    printf("putting value of type [%s] on lua stack\n", typeName.c_str());
-
-    int returnValueCount = 0;
-    if (!variant.is_type<void>())
-    {
-        if (variant.is_type<int>())
-        {
-            int value = variant.get_value<int>();
-            printf("pushing [%d] onto lua stack\n", value);
-            lua_pushnumber(L, value);
-            returnValueCount++;
-        }
-        else if (variant.get_type().is_class() || variant.get_type().is_pointer())
-        {
-            returnValueCount = CreateUserdata(L, variant);
-        }
-        else
-        {
-            luaL_error(L, "could not put value of unsupported type [%s] on lua stack\n", typeName.c_str());
-        }
-    }
-    printf("put [%d] values of type [%s] on lua stack\n", returnValueCount, typeName.c_str());
-    return returnValueCount;
-}
-
-int GetMethodArgumentCount(lua_State* L, const rttr::array_range<rttr::parameter_info>& argumentInfos)
-{
-    int luaArgumentCount = 0;
-    for (int i = lua_gettop(L); i > 0; i--)
-    {
-        if (lua_isuserdata(L, i))
-        {
-            break;
-        }
-        luaArgumentCount++;
-    }
-    int nativeArgumentCount = argumentInfos.size();
-    if (luaArgumentCount != nativeArgumentCount)
-    {
-        luaL_error(L, "lua vs. native argument count mismatch [%d != %d]\n", luaArgumentCount, nativeArgumentCount);
-    }
-    return luaArgumentCount;
-}
-
-int InvokeMethod(lua_State* L, const rttr::method& method, const rttr::instance& instance)
-{
-    const std::string& methodName = method.get_name().to_string();
-    printf("getting arguments for method [%s]\n", methodName.c_str());
-
-    const rttr::array_range<rttr::parameter_info>& argumentInfos = method.get_parameter_infos();
-    int argumentCount = GetMethodArgumentCount(L, argumentInfos);
-    printf("getting [%d] arguments for method [%s]\n", argumentCount, methodName.c_str());
-
-    std::vector<ArgumentValue> argumentValues(argumentCount);
-    std::vector<rttr::argument> arguments(argumentCount);
-    auto argumentInfoIterator = argumentInfos.begin();
-    for (int i = 0; i < argumentCount; i++, argumentInfoIterator++)
-    {
-        int luaIndex = lua_gettop(L) - i;
-        int luaType = lua_type(L, luaIndex);
-        const rttr::type& argumentType = argumentInfoIterator->get_type();
-
-        const char* luaTypeName = lua_typename(L, luaType);
-        const std::string& argumentTypeName = argumentType.get_name().to_string();
-        printf("parsing argument on lua index [%d] of lua type [%s] and native type [%s]\n", luaIndex, luaTypeName, argumentTypeName.c_str());
-
-        if (luaType == LUA_TNUMBER)
-        {
-            if (argumentType == rttr::type::get<int>())
-            {
-                auto intValue = (int) lua_tonumber(L, luaIndex);
-                printf("parsed int [%d]\n", intValue);
-                argumentValues[i].intValue = intValue;
-                arguments[i] = argumentValues[i].intValue;
-            }
-            else if (argumentType == rttr::type::get<long>())
-            {
-                auto longValue = (long) lua_tonumber(L, luaIndex);
-                printf("parsed long [%ld]\n", longValue);
-                argumentValues[i].longValue = longValue;
-                arguments[i] = argumentValues[i].longValue;
-            }
-            else if (argumentType == rttr::type::get<float>())
-            {
-                auto floatValue = (float) lua_tonumber(L, luaIndex);
-                printf("parsed float [%f]\n", floatValue);
-                argumentValues[i].floatValue = floatValue;
-                arguments[i] = argumentValues[i].floatValue;
-            }
-            else if (argumentType == rttr::type::get<double>())
-            {
-                auto doubleValue = (double) lua_tonumber(L, luaIndex);
-                printf("parsed double [%f]\n", doubleValue);
-                argumentValues[i].doubleValue = doubleValue;
-                arguments[i] = argumentValues[i].doubleValue;
-            }
-            else
-            {
-                luaL_error(L, "unknown native type [%s] for lua type [%s]\n", argumentTypeName.c_str(), luaTypeName);
-            }
-        }
-        else if (luaType == LUA_TSTRING)
-        {
-            const char* stringValue = lua_tostring(L, luaIndex);
-            printf("parsed string [%s]\n", stringValue);
-            argumentValues[i].stringValue = stringValue;
-            arguments[i] = argumentValues[i].stringValue;
-        }
-        else
-        {
-            luaL_error(L, "unknown lua type [%s]\n", luaTypeName);
-        }
-    }
-    std::reverse(arguments.begin(), arguments.end());
-
-    const rttr::variant& result = method.invoke_variadic(instance, arguments);
-    if (!result.is_valid())
-    {
-        luaL_error(L, "could not invoke method [%s] with [%d] arguments\n", methodName.c_str(), (int) arguments.size());
-    }
-    printf("invoked method [%s] with [%d] arguments\n", methodName.c_str(), (int) arguments.size());
-
-    const std::string& returnTypeName = result.get_type().get_name().to_string();
-    printf("return type from method [%s] is [%s]\n", methodName.c_str(), returnTypeName.c_str());
-
-    int returnValueCount = PutOnLuaStack(L, result);
-    printf("returning [%d] values of type [%s] from method [%s]\n", returnValueCount, returnTypeName.c_str(), methodName.c_str());
-    return returnValueCount;
-}
-
-int InvokeGlobalMethod(lua_State* L)
-{
-    printf("invoking global method from lua\n");
-
-    const auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
-    const std::string& methodName = method.get_name().to_string();
-    printf("invoking global method [%s]\n", methodName.c_str());
-
-    rttr::instance instance;
-    return InvokeMethod(L, method, instance);
-}
-
-std::string GetMetatableName(const rttr::type& type)
-{
-    std::string typeName;
-    if (type.is_pointer())
-    {
-        typeName = type.get_raw_type().get_name().to_string();
-    }
-    else
-    {
-        typeName = type.get_name().to_string();
-    }
-    return typeName.append("__metatable");
-}
-
-int CreateUserdata(lua_State* L)
-{
-    printf("creating userdata (i.e. native type) from lua\n");
-
-    const auto& type = *(rttr::type*) lua_touserdata(L, lua_upvalueindex(1));
-    const std::string& typeName = type.get_name().to_string();
-    printf("creating userdata for type [%s]\n", typeName.c_str());
-
-    void* userdata = lua_newuserdata(L, sizeof(rttr::variant));
-    new(userdata) rttr::variant(type.create());
-    int userdataIndex = lua_gettop(L);
-    printf("created userdata on lua index [%d] for type [%s]\n", userdataIndex, typeName.c_str());
-
-    const std::string& metatableName = GetMetatableName(type);
-    luaL_getmetatable(L, metatableName.c_str());
-    lua_setmetatable(L, userdataIndex);
-    printf("bound metatable [%s] to userdata on lua index [%d] for type [%s]\n", metatableName.c_str(), userdataIndex, typeName.c_str());
-
-    lua_newtable(L);
-    lua_setuservalue(L, userdataIndex);
-    printf("bound a new table to userdata on lua index [%d] for type [%s]\n", userdataIndex, typeName.c_str());
-
-    constexpr int createdCount = 1;
-    return createdCount;
-}
-
-int CreateUserdata(lua_State* L, const rttr::variant& variant)
-{
-    printf("creating native type from lua\n");
-
-    rttr::type type = variant.get_type();
-    const std::string& typeName = type.get_name().to_string();
-    printf("creating type [%s]\n", typeName.c_str());
-
-    void* userdata = lua_newuserdata(L, sizeof(rttr::variant));
-    new(userdata) rttr::variant(variant);
-    int userdataIndex = lua_gettop(L);
-    printf("created userdata on lua index [%d] for type [%s]\n", userdataIndex, typeName.c_str());
-
-    const std::string& metatableName = GetMetatableName(type);
-    luaL_getmetatable(L, metatableName.c_str());
-    lua_setmetatable(L, userdataIndex);
-    printf("bound metatable [%s] to userdata on lua index [%d] for type [%s]\n", metatableName.c_str(), userdataIndex, typeName.c_str());
-
-    lua_newtable(L);
-    lua_setuservalue(L, userdataIndex);
-    printf("bound a new table to userdata on lua index [%d] for type [%s]\n", userdataIndex, typeName.c_str());
-
-    constexpr int createdCount = 1;
-    return createdCount;
-}
-
-int DestroyUserdata(lua_State* L)
-{
-    printf("destroying native type from lua\n");
-    const auto& variant = *(rttr::variant*) lua_touserdata(L, -1);
-    variant.~variant();
-    printf("destroyed native type [%s]\n", variant.get_type().get_name().to_string().c_str());
-    return 0;
-}
-
-int InvokeMethodOnUserdata(lua_State* L)
-{
-    printf("invoking method on userdata\n");
-
-    auto& method = *(rttr::method*) lua_touserdata(L, lua_upvalueindex(1));
-    const std::string& methodName = method.get_name().to_string();
-    printf("invoking method [%s] on userdata\n", methodName.c_str());
-
-    constexpr int bottomOfLuaStackIndex = 1;
-    int userdataIndex = bottomOfLuaStackIndex;
-    if (!lua_isuserdata(L, userdataIndex))
-    {
-        luaL_error(L, "expected userdata on lua index [%d] when invoking method [%s]\n", userdataIndex, methodName.c_str());
-    }
-    const auto& variant = *(rttr::variant*) lua_touserdata(L, userdataIndex);
-    const std::string& typeName = variant.get_type().get_name().to_string();
-    printf("invoking method [%s] on userdata of type [%s]\n", methodName.c_str(), typeName.c_str());
-
-    rttr::instance instance(variant);
-    return InvokeMethod(L, method, instance);
-}
-
-int IndexUserdata(lua_State* L)
-{
-    printf("indexing userdata from lua\n");
-
-    const char* typeName = (const char*) lua_tostring(L, lua_upvalueindex(1));
-    const rttr::type& type = rttr::type::get_by_name(typeName);
-    printf("indexing userdata of type [%s]\n", typeName);
-
-    constexpr int bottomOfLuaStackIndex = 1;
-    int userdataIndex = bottomOfLuaStackIndex;
-    int keyIndex = userdataIndex + 1;
-
-    if (!lua_isuserdata(L, userdataIndex))
-    {
-        luaL_error(L, "expected userdata on lua index [%d] when indexing userdata of type [%s]\n", userdataIndex, typeName);
-    }
-    if (!lua_isstring(L, keyIndex))
-    {
-        luaL_error(L, "expected name of a native property or method on lua index [%d] when indexing userdata of type [%s]\n", keyIndex, typeName);
-    }
-
-    const char* key = lua_tostring(L, keyIndex);
-    printf("indexing userdata of type [%s] by key [%s]\n", typeName, key);
-
-    const rttr::method& method = type.get_method(key);
-    if (method.is_valid())
-    {
-        const std::string& methodName = method.get_name().to_string();
-        printf("found method [%s] to invoke on userdata of type [%s]\n", methodName.c_str(), typeName);
-
-        void* methodUserdata = lua_newuserdata(L, sizeof(rttr::method));
-        new(methodUserdata) rttr::method(method);
-        printf("created userdata for method [%s] to be invoked on userdata of type [%s]\n", methodName.c_str(), typeName);
-
-        constexpr int upvalueCount = 1;
-        lua_pushcclosure(L, InvokeMethodOnUserdata, upvalueCount);
-        printf("returning closure with method [%s] to be invoked on userdata of type [%s] as upvalue\n", methodName.c_str(), typeName);
-
-        int indexedMethodsCount = 1;
-        return indexedMethodsCount;
-    }
-
-    const rttr::property& property = type.get_property(key);
-    if (property.is_valid())
-    {
-        const std::string& propertyName = property.get_name().to_string();
-        printf("found property [%s] to read from userdata of type [%s]\n", propertyName.c_str(), typeName);
-
-        const rttr::variant& instance = *(rttr::variant*) lua_touserdata(L, bottomOfLuaStackIndex);
-        const rttr::variant& propertyValue = property.get_value(instance);
-        const std::string& propertyValueType = propertyValue.get_type().get_name().to_string();
-        printf("reading property [%s] of type [%s] from userdata of type [%s]\n", propertyName.c_str(), propertyValueType.c_str(), typeName);
-
-        int indexedPropertiesCount = PutOnLuaStack(L, propertyValue);
-        return indexedPropertiesCount;
-    }
-
-    printf("getting uservalue (i.e. table) for userdata on index [%d]\n", userdataIndex);
-    lua_getuservalue(L, userdataIndex);
-
-    printf("getting key for value in table on index [%d]\n", keyIndex);
-    lua_pushvalue(L, keyIndex);
-
-    printf("getting value on key in table\n");
-    lua_gettable(L, -2);
-
-    printf("returning value found on key on index [%d] in uservalue (i.e. table) on index [%d]\n", keyIndex, userdataIndex);
-    int indexedValuesCount = 1;
-    return indexedValuesCount;
-}
-
-int NewIndexOnUserdata(lua_State* L)
-{
-    printf("indexing type by unknown key from lua\n");
-
-    const char* typeName = (const char*) lua_tostring(L, lua_upvalueindex(1));
-    const rttr::type& type = rttr::type::get_by_name(typeName);
-    printf("indexing type [%s] by unknown key\n", typeName);
-
-    constexpr int bottomOfLuaStackIndex = 1;
-    int userdataIndex = bottomOfLuaStackIndex;
-    int keyIndex = userdataIndex + 1;
-    int valueIndex = keyIndex + 1;
-
-    if (!lua_isuserdata(L, userdataIndex))
-    {
-        luaL_error(L, "expected userdata on lua index [%d] when indexing type [%s]\n", userdataIndex, typeName);
-    }
-    if (!lua_isstring(L, keyIndex))
-    {
-        luaL_error(L, "expected name of a native property or method on lua index [%d] when indexing type [%s]\n", keyIndex, typeName);
-    }
-
-    const char* keyName = lua_tostring(L, keyIndex);
-    const rttr::property& property = type.get_property(keyName);
-    if (property.is_valid())
-    {
-        const std::string& propertyName = property.get_name().to_string();
-        printf("found property [%s] to write to on type [%s]\n", propertyName.c_str(), typeName);
-
-        const rttr::variant& instance = *(rttr::variant*) lua_touserdata(L, userdataIndex);
-        const std::string& instanceTypeName = instance.get_type().get_name().to_string();
-        printf("writing to property [%s] on instance of type [%s]\n", propertyName.c_str(), instanceTypeName.c_str());
-
-        int valueLuaType = lua_type(L, valueIndex);
-        const char* valueLuaTypeName = lua_typename(L, valueLuaType);
-        printf("writing value of lua type [%d: %s] to property [%s] on instance of type [%s]\n", valueLuaType, valueLuaTypeName, propertyName.c_str(),
-               instanceTypeName.c_str());
-
-        bool didSetValueOnProperty = false;
-        if (valueLuaType == LUA_TNUMBER)
-        {
-            if (property.get_type() == rttr::type::get<int>())
-            {
-                auto value = (int) lua_tonumber(L, valueIndex);
-                printf("setting value [%d] on property [%s]\n", value, propertyName.c_str());
-                didSetValueOnProperty = property.set_value(instance, value);
-            }
-            else if (property.get_type() == rttr::type::get<short>())
-            {
-                auto value = (short) lua_tonumber(L, valueIndex);
-                printf("setting value [%d] on property [%s]\n", value, propertyName.c_str());
-                didSetValueOnProperty = property.set_value(instance, value);
-            }
-            else
-            {
-                const std::string& propertyTypeName = property.get_type().get_name().to_string();
-                luaL_error(L, "unknown native type [%s] for lua type [%s]\n", propertyTypeName.c_str(), valueLuaTypeName);
-            }
-        }
-        else
-        {
-            luaL_error(L, "unknown lua type [%s]\n", valueLuaTypeName);
-        }
-        if (!didSetValueOnProperty)
-        {
-            luaL_error(L, "could not set value on property [%s] on type [%s]\n", propertyName.c_str(), typeName);
-        }
-        return 0;
-    }
-
-
-    printf("getting uservalue (i.e. table) for userdata on index [%d]\n", userdataIndex);
-    lua_getuservalue(L, userdataIndex);
-
-    printf("getting key [%s] for value in table on index [%d]\n", keyName, keyIndex);
-    lua_pushvalue(L, keyIndex);
-
-    printf("getting value for key [%s] in table on index [%d]\n", keyName, valueIndex);
-    lua_pushvalue(L, valueIndex);
-
-    printf("setting value on index [%d] on key on index [%d] on uservalue (i.e. table) on index [%d]\n", valueIndex, keyIndex, userdataIndex);
-    lua_settable(L, -3);
-
-    int valuesIndexedCount = 1;
-    return valuesIndexedCount;
-}
-
-int PutMethodArgumentsOnLuaStack(lua_State* L)
-{
-    return 0;
-}
-
-template<typename T>
-int PutMethodArgumentsOnLuaStack(lua_State* L, T& argument)
-{
-    const rttr::type& type = rttr::type::get<T>();
-    if (type.is_class())
-    {
-        rttr::variant variant(&argument);
-        return PutOnLuaStack(L, variant);
-    }
-    else
-    {
-        rttr::variant variant(argument);
-        return PutOnLuaStack(L, variant);
-    }
-}
-
-template<typename T, typename... E>
-int PutMethodArgumentsOnLuaStack(lua_State* L, T& argument, E& ... arguments)
-{
-    return PutMethodArgumentsOnLuaStack(L, argument) + PutMethodArgumentsOnLuaStack(L, arguments...);
-}
-
-template<typename... T>
-void CallLuaMethod(lua_State* L, const char* methodName, T& ... arguments)
-{
-    lua_getglobal(L, methodName);
-    int methodIndex = -1;
-    if (lua_type(L, methodIndex) != LUA_TFUNCTION)
-    {
-        luaL_error(L, "expected method [%s] on lua stack index [%d]", methodName, methodIndex);
-    }
-    int argumentCount = PutMethodArgumentsOnLuaStack(L, arguments...);
-    constexpr int resultsCount = 0;
-    constexpr int messageHandlerIndex = 0;
-    if (lua_pcall(L, argumentCount, resultsCount, messageHandlerIndex) != LUA_OK)
-    {
-        luaL_error(L, "could not call method [%s] on lua stack index [%d]: %s", methodName, methodIndex, lua_tostring(L, -1));
-    }
-}
-
-lua_State* CreateLuaState()
-{
-    lua_State* L = luaL_newstate();
-
-    lua_newtable(L);
-    lua_pushvalue(L, -1);
-    lua_setglobal(L, "Global");
-    for (const auto& method : rttr::type::get_global_methods())
-    {
-        lua_pushstring(L, method.get_name().to_string().c_str());
-        lua_pushlightuserdata(L, (void*) &method);
-        constexpr int upvalueCount = 1;
-        lua_pushcclosure(L, InvokeGlobalMethod, upvalueCount);
-        lua_settable(L, -3);
-    }
-
-    for (const auto& type : rttr::type::get_types())
-    {
-        const std::string& typeName = type.get_name().to_string();
-        if (type.is_class())
-        {
-            //printf("binding class type [%s] to lua\n", typeName.c_str());
-
-            lua_newtable(L);
-            lua_pushvalue(L, -1);
-            lua_setglobal(L, typeName.c_str());
-            //printf("created global [%s]\n", typeName.c_str());
-
-            lua_pushlightuserdata(L, (void*) &type);
-            constexpr int newUpvalueCount = 1;
-            lua_pushcclosure(L, CreateUserdata, newUpvalueCount);
-            lua_setfield(L, -2, "new");
-            //printf("added new/create function with upvalue [%s]\n", typeName.c_str());
-
-            const std::string& metatableName = GetMetatableName(type);
-            luaL_newmetatable(L, metatableName.c_str());
-            //printf("created metatable [%s]\n", metatableName.c_str());
-
-            lua_pushstring(L, "__gc");
-            lua_pushcfunction(L, DestroyUserdata);
-            lua_settable(L, -3);
-            //printf("added garbage collect function to metatable [%s]\n", metatableName.c_str());
-
-            lua_pushstring(L, "__index");
-            lua_pushstring(L, typeName.c_str());
-            constexpr int indexUpvalueCount = 1;
-            lua_pushcclosure(L, IndexUserdata, indexUpvalueCount);
-            lua_settable(L, -3);
-            //printf("added index function with upvalue [%s] to metatable [%s]\n", typeName.c_str(), metatableName.c_str());
-
-            lua_pushstring(L, "__newindex");
-            lua_pushstring(L, typeName.c_str());
-            constexpr int newindexUpvalueCount = 1;
-            lua_pushcclosure(L, NewIndexOnUserdata, newindexUpvalueCount);
-            lua_settable(L, -3);
-            //printf("added newindex function with upvalue [%s] to metatable [%s]\n", typeName.c_str(), metatableName.c_str());
-        }
-    }
-
-    return L;
-}
-
-void LoadLuaScript(lua_State* L, const char* script)
-{
-    if (luaL_loadstring(L, script) != LUA_OK)
-    {
-        luaL_error(L, "could not load lua script: %s", lua_tostring(L, -1));
-    }
-}
-
-void RunLua(lua_State* L)
-{
-    constexpr int argumentCount = 0;
-    constexpr int resultCount = LUA_MULTRET;
-    constexpr int messageHandlerIndex = 0;
-    if (lua_pcall(L, argumentCount, resultCount, messageHandlerIndex) != LUA_OK)
-    {
-        luaL_error(L, "could not run lua with loaded script: %s", lua_tostring(L, -1));
-    }
+            .property("x", &Sprite::x)(LuaFieldMetadata<&Sprite::x>())
+            .property("y", &Sprite::y)(LuaFieldMetadata<&Sprite::y>());
 }
 
 const char* LUA_SCRIPT = R"(
@@ -615,6 +109,11 @@ const char* LUA_SCRIPT = R"(
         sprite.x = 0
         sprite:Move(sprite.x, 10)
 
+        Sprite.Move_batch({ sprite, Sprite.new() }, 1, 1)
+
+        local pooledSprite = SpritePool.create()
+        SpritePool.x[pooledSprite] = 10
+
         function Foo(x, y)
             Global.HelloWorldWithArguments(x, y)
         end
@@ -627,29 +126,120 @@ const char* LUA_SCRIPT = R"(
             Global.HelloWorldWithArguments(0, 0)
         end
 
+        function Wait(milliseconds)
+            local waited = Global.Delay(milliseconds)
+            Global.HelloWorldWithArguments(milliseconds, waited)
+        end
+
         function Update(sprite)
             sprite.x = sprite.x + 10
             sprite:Move(0, 5)
         end
+
+        function ShouldDraw(sprite)
+            return sprite.x > 100, sprite
+        end
     )";
 
-int main()
+const char* LUA_SCRIPT_CACHE_DIRECTORY = "lua_cache";
+const char* LUA_PROFILE_PATH = "lua_profile.folded";
+
+lua_State* CreateScriptedLuaState()
+{
+    lua_State* L = CreateLuaState();
+    LoadLuaScript(L, LUA_SCRIPT, LUA_SCRIPT_CACHE_DIRECTORY);
+    RunLua(L);
+    return L;
+}
+
+int main(int argc, char** argv)
 {
     lua_State* L = CreateLuaState();
+    auto profiler = std::make_unique<LuaProfiler>(L);
+    auto methodStats = std::make_unique<LuaMethodStats>(L);
 
-    LoadLuaScript(L, LUA_SCRIPT);
+    LoadLuaScript(L, LUA_SCRIPT, LUA_SCRIPT_CACHE_DIRECTORY);
     RunLua(L);
 
+    if (argc > 1)
+    {
+        RunLuaScriptDirectory(L, argv[1]);
+    }
+
     int i = 1;
     int j = 2;
     CallLuaMethod(L, "Foo", i, j);
     CallLuaMethod(L, "Bar", i);
     CallLuaMethod(L, "Asd");
 
+    ComponentPool* spritePool = GetComponentPool(L, rttr::type::get<Sprite>());
+    int* spriteXs = spritePool->GetColumnData<int>("x");
+    for (uint32_t i = 0; i < spritePool->GetSize(); i++)
+    {
+        spriteXs[i] += 1;
+    }
+
     Sprite sprite;
     sprite.x = 100;
-    CallLuaMethod(L, "Update", sprite);
-    CallLuaMethod(L, "Update", sprite);
+    {
+        LuaFunctionRef update(L, "Update");
+        CallLuaMethod(update, sprite);
+        CallLuaMethod(update, sprite);
+
+        LuaFunctionRef shouldDraw(L, "ShouldDraw");
+        auto [draw, drawnSprite] = CallLuaMethod<std::tuple<bool, Sprite*>>(shouldDraw, sprite);
+        if (draw)
+        {
+            drawnSprite->Draw();
+        }
+    }
+
+    {
+        LuaTaskRunner taskRunner(L);
+        for (int milliseconds : {20, 10})
+        {
+            lua_getglobal(L, "Wait");
+            lua_pushinteger(L, milliseconds);
+            taskRunner.Start(1);
+        }
+        while (taskRunner.GetTaskCount() > 0)
+        {
+            taskRunner.WaitForCompletions();
+            taskRunner.Poll();
+        }
+        for (const std::string& error : taskRunner.TakeErrors())
+        {
+            fprintf(stderr, "lua task failed: %s\n", error.c_str());
+        }
+    }
+
+    const auto& allMethodStats = methodStats->GetMethodStats();
+    for (auto iterator = allMethodStats.begin(); iterator != allMethodStats.end(); iterator++)
+    {
+        LOG_INFO("called [%s] [%d] times, marshalling p50 [%d] ns, body p50 [%d] ns", iterator->second.name.c_str(), (int) iterator->second.callCount,
+                 (int) iterator->second.marshallingHistogram.GetPercentile(0.5), (int) iterator->second.bodyHistogram.GetPercentile(0.5));
+    }
+    methodStats.reset();
+    profiler->WriteFoldedStacks(LUA_PROFILE_PATH);
+    profiler.reset();
+    DestroyLuaState(L);
 
+    constexpr size_t statePoolCapacity = 2;
+    LuaStatePool statePool(statePoolCapacity, CreateScriptedLuaState, DestroyLuaState);
+    {
+        LuaStatePool::Lease lease = statePool.Acquire();
+        CallLuaMethod(lease.Get(), "Update", sprite);
+    }
+
+    LuaScheduler scheduler(std::thread::hardware_concurrency(), CreateScriptedLuaState, DestroyLuaState);
+    std::vector<std::future<void>> calls;
+    for (int k = 0; k < 4; k++)
+    {
+        calls.push_back(CallLuaMethodAsync(scheduler, "Foo", k, k));
+    }
+    for (std::future<void>& call : calls)
+    {
+        call.get();
+    }
     return 0;
 }
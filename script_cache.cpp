@@ -0,0 +1,178 @@
+#include "script_cache.h"
+#include "log.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char ScriptCacheMagic[8] = {'L', 'U', 'A', 'C', 'A', 'C', 'H', 'E'};
+
+    struct ScriptCacheHeader
+    {
+        char magic[sizeof(ScriptCacheMagic)];
+        char luaVersion[sizeof(LUA_VERSION_RELEASE)];
+        uint64_t sourceHash;
+        uint64_t sourceSize;
+    };
+
+    // FNV-1a, seeded with the lua version so bytecode from other lua versions never matches.
+    uint64_t HashSource(const char* source, size_t sourceSize)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto hashBytes = [&hash](const char* bytes, size_t size)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= (unsigned char) bytes[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        hashBytes(LUA_VERSION_RELEASE, sizeof(LUA_VERSION_RELEASE));
+        hashBytes(source, sourceSize);
+        return hash;
+    }
+
+    ScriptCacheHeader CreateHeader(uint64_t sourceHash, size_t sourceSize)
+    {
+        ScriptCacheHeader header = {};
+        memcpy(header.magic, ScriptCacheMagic, sizeof(header.magic));
+        memcpy(header.luaVersion, LUA_VERSION_RELEASE, sizeof(header.luaVersion));
+        header.sourceHash = sourceHash;
+        header.sourceSize = sourceSize;
+        return header;
+    }
+
+    // Compared field by field, the padding between the fields is not part of the entry.
+    bool IsMatchingHeader(const ScriptCacheHeader& header, const ScriptCacheHeader& expectedHeader)
+    {
+        return memcmp(header.magic, expectedHeader.magic, sizeof(header.magic)) == 0
+               && memcmp(header.luaVersion, expectedHeader.luaVersion, sizeof(header.luaVersion)) == 0
+               && header.sourceHash == expectedHeader.sourceHash
+               && header.sourceSize == expectedHeader.sourceSize;
+    }
+
+    bool ReadCacheFile(const std::filesystem::path& path, const ScriptCacheHeader& expectedHeader, std::string& bytecode)
+    {
+        FILE* file = fopen(path.string().c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        ScriptCacheHeader header = {};
+        bool didRead = fread(&header, sizeof(header), 1, file) == 1 && IsMatchingHeader(header, expectedHeader);
+        if (didRead)
+        {
+            char buffer[4096];
+            size_t readSize;
+            while ((readSize = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            {
+                bytecode.append(buffer, readSize);
+            }
+            didRead = ferror(file) == 0 && !bytecode.empty();
+        }
+        fclose(file);
+        return didRead;
+    }
+
+    // Unique per process, thread and write, so concurrent writers of the same entry never share a temporary file.
+    std::filesystem::path GetTemporaryPath(const std::filesystem::path& path)
+    {
+        static std::atomic<unsigned long long> writeCount = 0;
+#ifdef _WIN32
+        auto processId = (unsigned long long) _getpid();
+#else
+        auto processId = (unsigned long long) getpid();
+#endif
+        auto threadId = (unsigned long long) std::hash<std::thread::id>()(std::this_thread::get_id());
+        char suffix[80];
+        snprintf(suffix, sizeof(suffix), ".%llu.%llx.%llu.tmp", processId, threadId, writeCount++);
+        std::filesystem::path temporaryPath = path;
+        temporaryPath += suffix;
+        return temporaryPath;
+    }
+
+    // Written to a temporary file first and renamed into place, so a concurrently starting process or thread never
+    // reads a partial entry. Concurrent writers of the same entry each rename a complete file, the last one wins.
+    void WriteCacheFile(const std::filesystem::path& path, const ScriptCacheHeader& header, const std::string& bytecode)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+        const std::filesystem::path& temporaryPath = GetTemporaryPath(path);
+        FILE* file = fopen(temporaryPath.string().c_str(), "wb");
+        if (file == nullptr)
+        {
+            LOG_WARN("could not open script cache file [%s] for writing", temporaryPath.string().c_str());
+            return;
+        }
+        bool didWrite = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(bytecode.data(), 1, bytecode.size(), file) == bytecode.size();
+        didWrite = fclose(file) == 0 && didWrite;
+        if (didWrite)
+        {
+            std::filesystem::rename(temporaryPath, path, error);
+            didWrite = !error;
+        }
+        if (!didWrite)
+        {
+            LOG_WARN("could not write script cache file [%s]", path.string().c_str());
+            std::filesystem::remove(temporaryPath, error);
+        }
+    }
+}
+
+int DumpLuaChunk(lua_State* L, std::string& bytecode)
+{
+    auto writeBytecode = [](lua_State* /* L */, const void* data, size_t size, void* userdata)
+    {
+        static_cast<std::string*>(userdata)->append((const char*) data, size);
+        return 0;
+    };
+    constexpr int stripDebugInformation = 0;
+    return lua_dump(L, writeBytecode, &bytecode, stripDebugInformation);
+}
+
+int LoadCachedLuaChunk(lua_State* L, const char* source, size_t sourceSize, const char* chunkName, const std::string& cacheDirectory)
+{
+    uint64_t sourceHash = HashSource(source, sourceSize);
+    const ScriptCacheHeader& header = CreateHeader(sourceHash, sourceSize);
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "%016llx.luac", (unsigned long long) sourceHash);
+    const std::filesystem::path& path = std::filesystem::path(cacheDirectory) / fileName;
+
+    std::string bytecode;
+    if (ReadCacheFile(path, header, bytecode))
+    {
+        if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), chunkName, "b") == LUA_OK)
+        {
+            LOG_DEBUG("loaded chunk [%s] from script cache file [%s]", chunkName, path.string().c_str());
+            return LUA_OK;
+        }
+        LOG_WARN("could not load script cache file [%s], compiling source instead: %s", path.string().c_str(), lua_tostring(L, -1));
+        lua_pop(L, 1);
+        bytecode.clear();
+    }
+
+    int status = luaL_loadbufferx(L, source, sourceSize, chunkName, "t");
+    if (status != LUA_OK)
+    {
+        return status;
+    }
+    if (DumpLuaChunk(L, bytecode) == 0)
+    {
+        WriteCacheFile(path, header, bytecode);
+        LOG_DEBUG("wrote chunk [%s] to script cache file [%s]", chunkName, path.string().c_str());
+    }
+    return LUA_OK;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <lua/lua.hpp>
+#include <string>
+
+// Loads a lua chunk like luaL_loadbufferx, but keeps the compiled bytecode (lua_dump) in the cache directory, keyed by
+// a hash of the source and the lua version. Later loads of the same source use the bytecode and skip the compiler.
+// A missing, stale or unreadable cache entry falls back to compiling the source and rewrites the entry.
+// Returns the lua_load status, with the chunk or the error message on top of the lua stack.
+int LoadCachedLuaChunk(lua_State* L, const char* source, size_t sourceSize, const char* chunkName, const std::string& cacheDirectory);
+
+// Appends the bytecode of the lua function on top of the lua stack (with debug information) to the string.
+// Returns the lua_dump status.
+int DumpLuaChunk(lua_State* L, std::string& bytecode);
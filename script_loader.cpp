@@ -0,0 +1,264 @@
+#include "script_loader.h"
+#include "log.h"
+#include "script_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <cstdio>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Read-only view of a whole file. Falls back to reading the file into memory where mmap is not available.
+    class MappedFile
+    {
+    private:
+        const char* data = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        std::string buffer;
+#endif
+
+    public:
+        explicit MappedFile(const char* path)
+        {
+#ifdef _WIN32
+            FILE* file = fopen(path, "rb");
+            if (file == nullptr)
+            {
+                return;
+            }
+            char chunk[4096];
+            size_t readSize;
+            while ((readSize = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            {
+                buffer.append(chunk, readSize);
+            }
+            fclose(file);
+            data = buffer.data();
+            size = buffer.size();
+#else
+            int fileDescriptor = open(path, O_RDONLY);
+            if (fileDescriptor == -1)
+            {
+                return;
+            }
+            struct stat fileStatus = {};
+            if (fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0)
+            {
+                void* mapping = mmap(nullptr, (size_t) fileStatus.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+                if (mapping != MAP_FAILED)
+                {
+                    data = (const char*) mapping;
+                    size = (size_t) fileStatus.st_size;
+                }
+            }
+            else if (fileStatus.st_size == 0)
+            {
+                // An empty file is a valid (empty) chunk, but cannot be mapped
+                data = "";
+            }
+            close(fileDescriptor);
+#endif
+        }
+
+        ~MappedFile()
+        {
+#ifndef _WIN32
+            if (data != nullptr && size > 0)
+            {
+                munmap((void*) data, size);
+            }
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool IsValid() const
+        {
+            return data != nullptr;
+        }
+
+        const char* GetData() const
+        {
+            return data;
+        }
+
+        size_t GetSize() const
+        {
+            return size;
+        }
+    };
+
+    struct MappedFileReader
+    {
+        const char* data;
+        size_t size;
+        bool didRead;
+    };
+
+    // Hands the whole mapping to lua in one block, so the lexer reads straight from the mapped pages
+    const char* ReadMappedFile(lua_State* /* L */, void* data, size_t* size)
+    {
+        auto& reader = *(MappedFileReader*) data;
+        if (reader.didRead)
+        {
+            *size = 0;
+            return nullptr;
+        }
+        reader.didRead = true;
+        *size = reader.size;
+        return reader.data;
+    }
+
+    // Skips a first line starting with '#' (e.g. a shebang) like luaL_loadfilex does. The newline is kept,
+    // so line numbers in error messages still match the file.
+    size_t GetFirstLineCommentSize(const char* data, size_t size)
+    {
+        if (size == 0 || data[0] != '#')
+        {
+            return 0;
+        }
+        const void* newline = memchr(data, '\n', size);
+        return newline != nullptr ? (size_t) ((const char*) newline - data) : size;
+    }
+
+    struct CompiledChunk
+    {
+        std::filesystem::path path;
+        std::string chunkName;
+        std::string bytecode;
+        std::string error;
+        int status = LUA_OK;
+    };
+
+    void CompileChunk(CompiledChunk& chunk)
+    {
+        lua_State* L = luaL_newstate();
+        if (L == nullptr)
+        {
+            chunk.status = LUA_ERRMEM;
+            chunk.error = "not enough memory to compile lua file [" + chunk.path.string() + "]";
+            return;
+        }
+        chunk.status = LoadLuaFile(L, chunk.path.string().c_str());
+        if (chunk.status == LUA_OK)
+        {
+            DumpLuaChunk(L, chunk.bytecode);
+        }
+        else
+        {
+            chunk.error = lua_tostring(L, -1);
+        }
+        lua_close(L);
+    }
+}
+
+int LoadLuaFile(lua_State* L, const char* path)
+{
+    const std::string& chunkName = std::string("@") + path;
+    MappedFile file(path);
+    if (!file.IsValid())
+    {
+        lua_pushfstring(L, "could not open lua file [%s]", path);
+        return LUA_ERRFILE;
+    }
+    size_t commentSize = GetFirstLineCommentSize(file.GetData(), file.GetSize());
+    MappedFileReader reader = {file.GetData() + commentSize, file.GetSize() - commentSize, false};
+    return lua_load(L, ReadMappedFile, &reader, chunkName.c_str(), "t");
+}
+
+int RunLuaDirectory(lua_State* L, const char* directory)
+{
+    std::vector<CompiledChunk> chunks;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".lua")
+        {
+            CompiledChunk chunk;
+            chunk.path = entry.path();
+            chunk.chunkName.append("@").append(entry.path().string());
+            chunks.push_back(std::move(chunk));
+        }
+    }
+    if (error)
+    {
+        lua_pushfstring(L, "could not read lua directory [%s]: %s", directory, error.message().c_str());
+        return LUA_ERRFILE;
+    }
+    std::sort(chunks.begin(), chunks.end(), [](const CompiledChunk& a, const CompiledChunk& b) { return a.path < b.path; });
+
+    // Compiling is independent per file, only installing the chunks has to happen on the target lua state
+    std::atomic<size_t> nextChunkIndex = 0;
+    auto compileChunks = [&chunks, &nextChunkIndex]()
+    {
+        for (size_t i = nextChunkIndex++; i < chunks.size(); i = nextChunkIndex++)
+        {
+            CompileChunk(chunks[i]);
+        }
+    };
+    size_t threadCount = std::min<size_t>(chunks.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+    {
+        threads.emplace_back(compileChunks);
+    }
+    compileChunks();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    LOG_DEBUG("compiled [%d] lua files from directory [%s] on [%d] threads", (int) chunks.size(), directory, (int) std::max<size_t>(threadCount, 1));
+
+    // Nothing is installed unless every file compiled
+    for (const CompiledChunk& chunk : chunks)
+    {
+        if (chunk.status != LUA_OK)
+        {
+            lua_pushstring(L, chunk.error.c_str());
+            return chunk.status;
+        }
+    }
+    for (const CompiledChunk& chunk : chunks)
+    {
+        int status = luaL_loadbufferx(L, chunk.bytecode.data(), chunk.bytecode.size(), chunk.chunkName.c_str(), "b");
+        if (status != LUA_OK)
+        {
+            return status;
+        }
+        constexpr int argumentCount = 0;
+        constexpr int resultCount = 1;
+        constexpr int messageHandlerIndex = 0;
+        status = lua_pcall(L, argumentCount, resultCount, messageHandlerIndex);
+        if (status != LUA_OK)
+        {
+            return status;
+        }
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+        }
+        else
+        {
+            const std::string& moduleName = chunk.path.stem().string();
+            lua_setglobal(L, moduleName.c_str());
+            LOG_DEBUG("installed lua module [%s]", moduleName.c_str());
+        }
+    }
+    return LUA_OK;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <lua/lua.hpp>
+
+// Loads a lua file as a chunk, reading it through a memory mapping so the lexer consumes the mapped pages directly.
+// Like luaL_loadfilex, a first line starting with '#' is skipped. Only source files are accepted, not bytecode.
+// Returns the lua_load status, with the chunk or the error message on top of the lua stack.
+int LoadLuaFile(lua_State* L, const char* path);
+
+// Compiles every .lua file in the directory in parallel, each in its own scratch lua state, then loads the compiled
+// chunks into the lua state and runs them one by one in file name order. A chunk that returns a value is installed as
+// a global named after its file, e.g. the table returned by "enemies.lua" becomes the global "enemies".
+// Returns the status of the first chunk that failed to compile or run, with its error message on top of the lua stack.
+// When a file fails to compile no chunk is run, but when a chunk fails to run the chunks before it stay installed.
+int RunLuaDirectory(lua_State* L, const char* directory);